@@ -0,0 +1,82 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _POWERDSTATUS_H_
+#define _POWERDSTATUS_H_
+
+/**
+ * Layout of the status page powerd shares with libpowerd.
+ *
+ * powerd is the only writer. Readers never block it: the page is protected by a sequence
+ * lock, the sequence is odd while an update is in progress and readers retry if it changed
+ * while they were copying.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "powerd.h"
+
+#define POWERD_STATUS_PAGE_PATH     "/run/powerd-status"
+#define POWERD_STATUS_PAGE_MAGIC    0x50575244
+#define POWERD_STATUS_PAGE_VERSION  1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t sequence;
+
+    uint32_t battery_valid;
+    uint32_t charger_valid;
+
+    PowerdBatteryStatus battery;
+    PowerdChargerStatus charger;
+} PowerdStatusPage;
+
+static inline void
+PowerdStatusPageWriteBegin(PowerdStatusPage *page)
+{
+    page->sequence++;
+    __sync_synchronize();
+}
+
+static inline void
+PowerdStatusPageWriteEnd(PowerdStatusPage *page)
+{
+    __sync_synchronize();
+    page->sequence++;
+}
+
+static inline uint32_t
+PowerdStatusPageReadBegin(const PowerdStatusPage *page)
+{
+    uint32_t sequence = page->sequence;
+    __sync_synchronize();
+    return sequence;
+}
+
+static inline bool
+PowerdStatusPageReadRetry(const PowerdStatusPage *page, uint32_t sequence)
+{
+    __sync_synchronize();
+    return (sequence & 1) || page->sequence != sequence;
+}
+
+#endif // _POWERDSTATUS_H_
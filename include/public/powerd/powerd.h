@@ -32,6 +32,35 @@ extern "C" {
  * See doxygen pages for more information.
  */
 
+/**
+ * Battery state as last published by powerd, see PowerdBatteryStatusGet().
+ */
+typedef struct
+{
+    int32_t percent;
+    int32_t percent_ui;
+    int32_t temperature_C;
+    int32_t current_mA;
+    int32_t voltage_mV;
+    double  capacity_mAh;
+    int32_t time_to_empty_min;
+    int32_t time_to_full_min;
+} PowerdBatteryStatus;
+
+/**
+ * Charger state as last published by powerd, see PowerdChargerStatusGet().
+ */
+typedef struct
+{
+    bool    connected;
+    bool    usb_powered;
+    bool    dock_powered;
+    bool    charging;
+    int32_t max_current_mA;
+    char    type[16];
+    char    name[16];
+} PowerdChargerStatus;
+
 typedef void (*PowerdCallback)(void);
 typedef void (*PowerdCallback_Int32)(int);
 typedef void (*PowerdCallback_Int32_4)(int, int, int, int);
@@ -64,6 +93,9 @@ void PowerdGetBatteryStatusNotification(void);
 
 void PowerdBatteryStatusRegister(PowerdCallback_Int32_4 callback);
 
+bool PowerdBatteryStatusGet(PowerdBatteryStatus *status);
+bool PowerdChargerStatusGet(PowerdChargerStatus *status);
+
 int PowerdSetDisplayMode(bool on);
 int PowerdSetBacklightBrightness(int32_t percentBrightness);
 int PowerdSetKeylightBrightness(int32_t percentBrightness);
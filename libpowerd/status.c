@@ -0,0 +1,142 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file status.c
+ *
+ * @brief Lock-free access to the battery and charger state powerd publishes in its status page.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "powerd.h"
+#include "powerdstatus.h"
+
+/* @brief Give up after this many torn reads, powerd is then busy writing. */
+#define STATUS_PAGE_READ_RETRIES 100
+
+/* @brief Set once by whichever thread maps the page first, never unmapped. */
+static const PowerdStatusPage * volatile sStatusPage = NULL;
+
+static void
+_StatusPageMap(void)
+{
+    struct stat st;
+    int fd = open(POWERD_STATUS_PAGE_PATH, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    /* Reading past the end of a short file would fault, wait until powerd has sized it. */
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(PowerdStatusPage))
+    {
+        close(fd);
+        return;
+    }
+
+    void *addr = mmap(NULL, sizeof(PowerdStatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return;
+
+    /* Another thread may have mapped it meanwhile, keep theirs. */
+    if (!__sync_bool_compare_and_swap(&sStatusPage, NULL, addr))
+        munmap(addr, sizeof(PowerdStatusPage));
+}
+
+static const PowerdStatusPage *
+_StatusPageGet(void)
+{
+    /* powerd may not have created the page yet, so keep trying until it has. */
+    if (!sStatusPage)
+        _StatusPageMap();
+
+    const PowerdStatusPage *page = sStatusPage;
+
+    if (!page || page->magic != POWERD_STATUS_PAGE_MAGIC ||
+        page->version != POWERD_STATUS_PAGE_VERSION)
+        return NULL;
+
+    return page;
+}
+
+/** 
+* @brief Read the battery state last published by powerd, without any IPC.
+* 
+* @param  status 
+* 
+* @retval false if powerd has not published a battery state (yet).
+*/
+bool
+PowerdBatteryStatusGet(PowerdBatteryStatus *status)
+{
+    const PowerdStatusPage *page = _StatusPageGet();
+    uint32_t sequence;
+    bool valid;
+    int retries = STATUS_PAGE_READ_RETRIES;
+
+    if (!page || !status)
+        return false;
+
+    do {
+        if (!retries--)
+            return false;
+
+        sequence = PowerdStatusPageReadBegin(page);
+        valid = page->battery_valid;
+        *status = page->battery;
+    } while (PowerdStatusPageReadRetry(page, sequence));
+
+    return valid;
+}
+
+/** 
+* @brief Read the charger state last published by powerd, without any IPC.
+* 
+* @param  status 
+* 
+* @retval false if powerd has not published a charger state (yet).
+*/
+bool
+PowerdChargerStatusGet(PowerdChargerStatus *status)
+{
+    const PowerdStatusPage *page = _StatusPageGet();
+    uint32_t sequence;
+    bool valid;
+    int retries = STATUS_PAGE_READ_RETRIES;
+
+    if (!page || !status)
+        return false;
+
+    do {
+        if (!retries--)
+            return false;
+
+        sequence = PowerdStatusPageReadBegin(page);
+        valid = page->charger_valid;
+        *status = page->charger;
+    } while (PowerdStatusPageReadRetry(page, sequence));
+
+    return valid;
+}
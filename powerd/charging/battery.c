@@ -23,6 +23,7 @@
  * @brief Battery interface calls to read the battery values.
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 #include <stdbool.h>
@@ -32,40 +33,339 @@
 #include <luna-service2/lunaservice.h>
 
 #include "init.h"
+#include "clock.h"
 #include "debug.h"
 #include "logging.h"
 #include "main.h"
 #include "battery.h"
+#include "batteryhistory.h"
+#include "batteryestimate.h"
+#include "batterysignal.h"
+#include "batterythermal.h"
+#include "batterywakeup.h"
+#include "charging_logic.h"
 #include "config.h"
 #include "sysfs.h"
+#include "subscription.h"
+#include "statuspage.h"
 
 #define LOG_DOMAIN "BATTERY_IPC: "
 
-static nyx_device_handle_t battDev = NULL;
+#define BATTERY_ID_SIZE		32
 
 nyx_battery_ctia_t battery_ctia_params;
 
+/**
+ * @brief One nyx battery device and the last sample read from its fuel gauge.
+ *
+ * Every consumer of battery_read() within the same generation shares the samples, as long as they
+ * are not older than the configured freshness window. The generation is bumped whenever something
+ * changed for all devices (charger events, resume...), while a nyx callback only marks its own
+ * device stale, so one event only ever queries the gauge that raised it.
+ */
+struct battery_device {
+	nyx_device_handle_t  handle;
+	char                 id[BATTERY_ID_SIZE];
 
-void battery_read(nyx_battery_status_t *status)
+	nyx_battery_status_t sample;
+	struct timespec      read_time;
+	guint                generation;
+	bool                 valid;
+	bool                 stale;
+};
+
+/* @brief The first device found is the main pack, the one powering the system rail. */
+static struct battery_device battery_devices[BATTERY_MAX_DEVICES];
+static int battery_device_num = 0;
+
+static guint battery_sample_generation = 0;
+
+static struct {
+	guint hits;
+	guint misses;
+} battery_sample_cache;
+
+/**
+ * @brief Combined view of all battery devices.
+ *
+ * The additive quantities are kept as running sums, updated with the difference between the old
+ * and the new sample of the one device that was read, so the cost of an update does not depend on
+ * the number of devices. The temperature is the hottest device, the voltage, age and CTIA related
+ * values are the ones of the main pack.
+ */
+static struct {
+	nyx_battery_status_t combined;
+
+	int    present;
+	int    charging;
+	int    current;
+	int    avg_current;
+	double capacity;
+	double capacity_raw;
+	double capacity_full40;
+	double weighted_percent;
+	double weight;
+
+	int    hottest;
+
+	/* @brief Bumped whenever any device is read, see battery_status_payload(). */
+	guint  revision;
+} battery_aggregate = { .hottest = -1 };
+
+/**
+ * @brief Mark the cached battery samples as stale, forcing the next battery_read() to query all gauges.
+ */
+void battery_sample_invalidate(void)
 {
-	if(battDev == NULL)
+	battery_sample_generation++;
+}
+
+/**
+ * @brief Return the number of battery_read() calls served from the cache and from the gauges.
+ */
+void battery_sample_cache_stats(guint *hits, guint *misses)
+{
+	if(hits)
+		*hits = battery_sample_cache.hits;
+	if(misses)
+		*misses = battery_sample_cache.misses;
+}
+
+/**
+ * @brief Return the number of battery devices in use.
+ */
+int battery_device_count(void)
+{
+	return battery_device_num;
+}
+
+static bool battery_device_is_fresh(struct battery_device *dev, struct timespec *now)
+{
+	struct timespec age;
+
+	if(!dev->valid || dev->stale ||
+		dev->generation != battery_sample_generation)
+		return false;
+
+	ClockDiff(&age, now, &dev->read_time);
+
+	return ClockGetMs(&age) < gChargeConfig.battery_sample_window_ms;
+}
+
+/**
+ * @brief Weight of a device in the combined percentage : its full capacity.
+ */
+static double battery_device_weight(nyx_battery_status_t *sample)
+{
+	if(sample->capacity_full40 > 0)
+		return sample->capacity_full40;
+	if(sample->percentage > 0)
+		return sample->capacity * 100 / sample->percentage;
+	return 0;
+}
+
+static void battery_aggregate_add(nyx_battery_status_t *sample, int sign)
+{
+	double weight = battery_device_weight(sample);
+
+	battery_aggregate.present += sign * (sample->present ? 1 : 0);
+	battery_aggregate.charging += sign * (sample->charging ? 1 : 0);
+	battery_aggregate.current += sign * sample->current;
+	battery_aggregate.avg_current += sign * sample->avg_current;
+	battery_aggregate.capacity += sign * sample->capacity;
+	battery_aggregate.capacity_raw += sign * sample->capacity_raw;
+	battery_aggregate.capacity_full40 += sign * sample->capacity_full40;
+	battery_aggregate.weighted_percent += sign * weight * sample->percentage;
+	battery_aggregate.weight += sign * weight;
+}
+
+static void battery_aggregate_hottest(void)
+{
+	int i;
+
+	battery_aggregate.hottest = -1;
+	for(i = 0; i < battery_device_num; i++)
+	{
+		if(!battery_devices[i].valid)
+			continue;
+		if(battery_aggregate.hottest < 0 ||
+			battery_devices[i].sample.temperature >
+			battery_devices[battery_aggregate.hottest].sample.temperature)
+			battery_aggregate.hottest = i;
+	}
+}
+
+/**
+ * @brief Fold a new sample of device i into the combined view.
+ */
+static void battery_aggregate_update(int i, nyx_battery_status_t *sample)
+{
+	struct battery_device *dev = &battery_devices[i];
+	nyx_battery_status_t *combined = &battery_aggregate.combined;
+	int previous_temperature = dev->sample.temperature;
+
+	if(dev->valid)
+		battery_aggregate_add(&dev->sample, -1);
+
+	battery_aggregate_add(sample, 1);
+	dev->sample = *sample;
+	dev->valid = true;
+	battery_aggregate.revision++;
+
+	/* Only rescan all devices when the hottest one cooled down. */
+	if(battery_aggregate.hottest == i)
+	{
+		if(sample->temperature < previous_temperature)
+			battery_aggregate_hottest();
+	}
+	else if(battery_aggregate.hottest < 0 ||
+		sample->temperature >= battery_devices[battery_aggregate.hottest].sample.temperature)
+		battery_aggregate.hottest = i;
+
+	if(battery_device_num == 1)
+	{
+		*combined = *sample;
 		return;
+	}
 
-	nyx_error_t err = nyx_battery_query_battery_status(battDev,status);
+	if(battery_devices[0].valid)
+		*combined = battery_devices[0].sample;
+
+	combined->present = battery_aggregate.present > 0;
+	combined->charging = battery_aggregate.charging > 0;
+	combined->current = battery_aggregate.current;
+	combined->avg_current = battery_aggregate.avg_current;
+	combined->capacity = battery_aggregate.capacity;
+	combined->capacity_raw = battery_aggregate.capacity_raw;
+	combined->capacity_full40 = battery_aggregate.capacity_full40;
+	combined->temperature = battery_devices[battery_aggregate.hottest].sample.temperature;
+	if(battery_aggregate.weight > 0)
+		combined->percentage = (int)(battery_aggregate.weighted_percent / battery_aggregate.weight + 0.5);
+}
+
+/**
+ * @brief Query the gauge of device i if its cached sample is stale.
+ *
+ * @retval true if the gauge was queried.
+ */
+static bool battery_device_update(int i, struct timespec *now)
+{
+	struct battery_device *dev = &battery_devices[i];
+	nyx_battery_status_t sample = {0};
+
+	if(battery_device_is_fresh(dev, now))
+		return false;
+
+	nyx_error_t err = nyx_battery_query_battery_status(dev->handle, &sample);
 
 	if(err != NYX_ERROR_NONE)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_battery_query_battery_status returned with error : %d",__func__,err);
+		POWERDLOG(LOG_ERR,"%s: nyx_battery_query_battery_status on \"%s\" returned with error : %d",
+				__func__,dev->id,err);
+		return false;
+	}
+
+	battery_aggregate_update(i, &sample);
+
+	dev->generation = battery_sample_generation;
+	dev->stale = false;
+	dev->read_time = *now;
+
+	return true;
+}
+
+static int getUiPercent(int percent);
+
+/**
+ * @brief Mirror the given sample into the shared status page read by libpowerd.
+ */
+static void battery_status_page_publish(nyx_battery_status_t *status)
+{
+	PowerdBatteryStatus battery = {
+		.percent = status->percentage,
+		.percent_ui = getUiPercent(status->percentage),
+		.temperature_C = status->temperature,
+		.current_mA = status->current,
+		.voltage_mV = status->voltage,
+		.capacity_mAh = status->capacity,
+		.time_to_empty_min = battery_estimate_minutes_to_empty(),
+		.time_to_full_min = battery_estimate_minutes_to_full(),
+	};
+
+	StatusPagePublishBattery(&battery);
+}
+
+/**
+ * @brief Feed a sample freshly read from the fuel gauges to the modules tracking battery trends.
+ */
+static void battery_sample_new(nyx_battery_status_t *status)
+{
+	ChargePhaseUpdate(status);
+	battery_history_add(status, ChargePhaseGet());
+	battery_estimate_update(status);
+	battery_thermal_update(status);
+	battery_status_page_publish(status);
+}
+
+/**
+ * @brief Read the combined state of all battery devices, only querying the gauges whose cached
+ * sample is stale.
+ */
+void battery_read(nyx_battery_status_t *status)
+{
+	struct timespec now;
+	bool queried = false;
+	int i;
+
+	if(battery_device_num == 0)
+		return;
+
+	ClockGetTime(&now);
+	for(i = 0; i < battery_device_num; i++)
+		queried |= battery_device_update(i, &now);
+
+	if(queried)
+	{
+		battery_sample_cache.misses++;
+		battery_sample_new(&battery_aggregate.combined);
+	}
+	else
+		battery_sample_cache.hits++;
+
+	*status = battery_aggregate.combined;
+
+	POWERDLOG(LOG_DEBUG,"%s: sample cache hits %u, misses %u",__func__,
+			battery_sample_cache.hits, battery_sample_cache.misses);
+}
+
+/**
+ * @brief Read the state of a single battery device.
+ */
+void battery_read_device(int i, nyx_battery_status_t *status)
+{
+	struct timespec now;
+
+	if(i < 0 || i >= battery_device_num)
 		return;
+
+	ClockGetTime(&now);
+	if(battery_device_update(i, &now))
+	{
+		battery_sample_cache.misses++;
+		battery_sample_new(&battery_aggregate.combined);
 	}
+	else
+		battery_sample_cache.hits++;
+
+	*status = battery_devices[i].sample;
 }
 
 
 int battery_get_ctia_params(void)
 {
-	if(!battDev)
+	if(!battery_device_num)
 		return -1;
-	nyx_error_t err = nyx_battery_get_ctia_parameters(battDev,&battery_ctia_params);
+	nyx_error_t err = nyx_battery_get_ctia_parameters(battery_devices[0].handle,&battery_ctia_params);
 
 	if(err != NYX_ERROR_NONE)
 	{
@@ -78,47 +378,74 @@ int battery_get_ctia_params(void)
 
 
 
-bool battery_authenticate()
+/**
+ * @brief Authenticate a single battery device.
+ */
+bool battery_authenticate_device(int i)
 {
-	bool result;
+	bool result = false;
 
-    if (battery_ctia_params.skip_battery_authentication)
-    	return true;
-	nyx_battery_authenticate_battery(battDev, &result);
+	if (battery_ctia_params.skip_battery_authentication)
+		return true;
+	if(i < 0 || i >= battery_device_num)
+		return false;
+	nyx_battery_authenticate_battery(battery_devices[i].handle, &result);
 	return result;
 }
 
+/**
+ * @brief Authenticate all battery devices, a single counterfeit pack fails the whole check.
+ */
+bool battery_authenticate()
+{
+	int i;
+
+	for(i = 0; i < battery_device_num; i++)
+		if(!battery_authenticate_device(i))
+			return false;
+	return true;
+}
+
+static void battery_status_send(nyx_battery_status_t *status);
+
+/**
+ * @brief Arm the wakeup level of every gauge, see batterywakeup.c, and broadcast the state
+ * read for it.
+ */
 void battery_set_wakeup_percentage(bool charging, bool suspend)
 {
-	int battlowpercent[] = {20,13,11,9,6,5,4,3,2,1,0};
 	nyx_battery_status_t batt;
-	int nextchk = 0,i = 0;
+	int nextchk = 0,dev = 0;
 
-	if(!battDev)
+	if(!battery_device_num)
 		return;
 
 	POWERDLOG(LOG_DEBUG, "In %s\n",__FUNCTION__);
 	battery_read(&batt);
-	sendBatteryStatus();
+	battery_status_send(&batt);
 
-	if(charging) {
-		nextchk = 0;
-	}
-	else if(suspend) {
-		for(i=0; battlowpercent[i]!=0; i++) {
-			if(batt.percentage > battlowpercent[i])
-			{
-				nextchk=battlowpercent[i];
-				break;
-			}
+	/* Each gauge raises its own wakeup, so the limit is computed from each device's own level. */
+	for(dev = 0; dev < battery_device_num; dev++)
+	{
+		int percent = battery_devices[dev].sample.percentage;
+
+		if(charging) {
+			battery_wakeup_charging(dev);
+			nextchk = 0;
+		}
+		else if(suspend) {
+			battery_wakeup_suspend(dev, percent);
+			nextchk = battery_wakeup_threshold(dev, percent);
+		}
+		else {
+			battery_wakeup_resume(dev, percent);
+			nextchk = percent;
 		}
-	}
-	else
-		nextchk=batt.percentage;
 
-	POWERDLOG(LOG_DEBUG, "Setting percent limit to %d\n",nextchk);
+		POWERDLOG(LOG_DEBUG, "Setting percent limit of \"%s\" to %d\n",battery_devices[dev].id,nextchk);
 
-	nyx_battery_set_wakeup_percentage(battDev, nextchk);
+		nyx_battery_set_wakeup_percentage(battery_devices[dev].handle, nextchk);
+	}
 }
 
 
@@ -166,55 +493,253 @@ static int getUiPercent(int percent)
 }
 
 
-bool batteryStatusQuery(LSHandle *sh,
-                   LSMessage *message, void *user_data)
-{
+/**
+ * @brief Serialized batteryStatus payload, shared by the query reply and the broadcast signal.
+ *
+ * The JSON is only rebuilt when one of the published fields of the sample differs from the
+ * sample it was last built from, or when any device sample changed. With more than one battery
+ * device, the payload carries the combined view and a "batteries" array with each device.
+ */
+#define BATTERY_PAYLOAD_SIZE	(320 + BATTERY_MAX_DEVICES * 192)
+
+/* @brief Resolution of the charge phase durations published while a phase is running. */
+#define BATTERY_PAYLOAD_PHASE_GRANULARITY_S	60
+
+static struct {
 	nyx_battery_status_t status;
-	if(!battDev)
-		return false;
+	int                  minutes_to_empty;
+	int                  minutes_to_full;
+	ChargePhase          phase;
+	int                  phase_cc_s;
+	int                  phase_taper_s;
+	guint                revision;
+	bool                 valid;
+	char                 payload[BATTERY_PAYLOAD_SIZE];
+} battery_payload_cache;
 
-	nyx_error_t err = nyx_battery_query_battery_status(battDev,&status);
+/**
+ * @brief Charge phase durations as published. The durations of a running phase grow every
+ * second, so they are rounded down to keep them from invalidating the payload on every call.
+ */
+static void
+battery_payload_phase_durations(int *cc_s, int *taper_s)
+{
+	ChargePhaseDurations(cc_s, taper_s);
 
-	if(err != NYX_ERROR_NONE)
+	if(ChargePhaseGet() == kChargePhaseConstantCurrent || ChargePhaseGet() == kChargePhaseTaper)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_battery_status returned with error : %d",__func__,err);
+		*cc_s -= *cc_s % BATTERY_PAYLOAD_PHASE_GRANULARITY_S;
+		*taper_s -= *taper_s % BATTERY_PAYLOAD_PHASE_GRANULARITY_S;
 	}
-	int percent_ui = getUiPercent(status.percentage);
+}
+
+static bool
+battery_payload_is_current(nyx_battery_status_t *status)
+{
+	nyx_battery_status_t *last = &battery_payload_cache.status;
+	int cc_s, taper_s;
+
+	battery_payload_phase_durations(&cc_s, &taper_s);
+
+	return battery_payload_cache.valid &&
+		last->percentage == status->percentage &&
+		last->temperature == status->temperature &&
+		last->current == status->current &&
+		last->voltage == status->voltage &&
+		last->capacity == status->capacity &&
+		battery_payload_cache.minutes_to_empty == battery_estimate_minutes_to_empty() &&
+		battery_payload_cache.minutes_to_full == battery_estimate_minutes_to_full() &&
+		battery_payload_cache.phase == ChargePhaseGet() &&
+		battery_payload_cache.phase_cc_s == cc_s &&
+		battery_payload_cache.phase_taper_s == taper_s &&
+		(battery_device_num == 1 || battery_payload_cache.revision == battery_aggregate.revision);
+}
+
+/**
+ * @brief Append the "batteries" array describing each device to the payload.
+ */
+static void
+battery_devices_payload(char *payload, size_t size)
+{
+	size_t len = strlen(payload);
+	int i;
 
+	/* Reopen the object closed by battery_status_payload(). */
+	if(len == 0 || len >= size)
+		return;
+	len--;
+
+	len += snprintf(payload + len, size - len, ",\"batteries\":[");
+	for(i = 0; i < battery_device_num && len < size; i++)
+	{
+		nyx_battery_status_t *sample = &battery_devices[i].sample;
+
+		len += snprintf(payload + len, size - len,
+				"%s{\"id\":\"%s\",\"present\":%s,\"percent\":%d,"
+				"\"temperature_C\":%d,\"current_mA\":%d,\"voltage_mV\":%d,"
+				"\"capacity_mAh\":%f}",
+			i ? "," : "",
+			battery_devices[i].id,
+			sample->present ? "true" : "false",
+			sample->percentage,
+			sample->temperature,
+			sample->current,
+			sample->voltage,
+			sample->capacity);
+	}
+	if(len < size)
+		snprintf(payload + len, size - len, "]}");
+}
+
+/**
+ * @brief Return the batteryStatus JSON payload for the given sample.
+ */
+static const char *
+battery_status_payload(nyx_battery_status_t *status)
+{
+	if(battery_payload_is_current(status))
+		return battery_payload_cache.payload;
+
+	int percent_ui = getUiPercent(status->percentage);
+	int cc_s, taper_s;
+
+	battery_payload_phase_durations(&cc_s, &taper_s);
 
 	POWERDLOG(LOG_INFO,
 			"(%fmAh, %d%%, %d%%_ui, %dC, %dmA, %dmV)\n",
-			status.capacity, status.percentage,
+			status->capacity, status->percentage,
 			percent_ui,
-			status.temperature,
-			status.current, status.voltage);
+			status->temperature,
+			status->current, status->voltage);
 
-	GString *buffer = g_string_sized_new(500);
-	g_string_append_printf(buffer,"{\"percent\":%d,\"percent_ui\":%d,"
+	snprintf(battery_payload_cache.payload, BATTERY_PAYLOAD_SIZE,
+				"{\"percent\":%d,\"percent_ui\":%d,"
 				"\"temperature_C\":%d,\"current_mA\":%d,\"voltage_mV\":%d,"
-				"\"capacity_mAh\":%f}",
-		status.percentage,
+				"\"capacity_mAh\":%f,\"time_to_empty_min\":%d,\"time_to_full_min\":%d,"
+				"\"charge_phase\":\"%s\",\"charge_cc_s\":%d,\"charge_taper_s\":%d}",
+		status->percentage,
 		percent_ui,
-		status.temperature,
-		status.current,
-		status.voltage,
-		status.capacity);
+		status->temperature,
+		status->current,
+		status->voltage,
+		status->capacity,
+		battery_estimate_minutes_to_empty(),
+		battery_estimate_minutes_to_full(),
+		ChargePhaseName(ChargePhaseGet()),
+		cc_s,
+		taper_s);
+
+	if(battery_device_num > 1)
+		battery_devices_payload(battery_payload_cache.payload, BATTERY_PAYLOAD_SIZE);
+
+	battery_payload_cache.status = *status;
+	battery_payload_cache.revision = battery_aggregate.revision;
+	battery_payload_cache.minutes_to_empty = battery_estimate_minutes_to_empty();
+	battery_payload_cache.minutes_to_full = battery_estimate_minutes_to_full();
+	battery_payload_cache.phase = ChargePhaseGet();
+	battery_payload_cache.phase_cc_s = cc_s;
+	battery_payload_cache.phase_taper_s = taper_s;
+	battery_payload_cache.valid = true;
+
+	return battery_payload_cache.payload;
+}
+
+/**
+ * @brief Fields batteryStatusQuery subscribers can filter on, in the order of battery_subscription_values().
+ */
+static const char *battery_subscription_fields[] = {
+	"percent",
+	"percent_ui",
+	"temperature_C",
+	"current_mA",
+	"voltage_mV",
+	"capacity_mAh",
+	"time_to_empty_min",
+	"time_to_full_min",
+};
+
+static SubscriptionList *battery_subscriptions = NULL;
+
+static void
+battery_subscription_values(nyx_battery_status_t *status, int *values)
+{
+	values[0] = status->percentage;
+	values[1] = getUiPercent(status->percentage);
+	values[2] = status->temperature;
+	values[3] = status->current;
+	values[4] = status->voltage;
+	values[5] = status->capacity;
+	values[6] = battery_estimate_minutes_to_empty();
+	values[7] = battery_estimate_minutes_to_full();
+}
+
+/**
+ * @brief Reply to the batteryStatusQuery subscribers affected by the given sample.
+ */
+static void
+battery_subscriptions_notify(nyx_battery_status_t *status)
+{
+	int values[G_N_ELEMENTS(battery_subscription_fields)];
+
+	if(!battery_subscriptions || !SubscriptionListCount(battery_subscriptions))
+		return;
+
+	battery_subscription_values(status, values);
+	SubscriptionListNotify(battery_subscriptions, values, battery_status_payload(status));
+}
+
+bool batteryStatusQuery(LSHandle *sh,
+                   LSMessage *message, void *user_data)
+{
+	nyx_battery_status_t status = {0};
+	int values[G_N_ELEMENTS(battery_subscription_fields)];
+	if(!battery_device_num)
+		return false;
 
-	char *payload = g_string_free(buffer, FALSE);
+	battery_read(&status);
+	const char *payload = battery_status_payload(&status);
+
+	battery_subscription_values(&status, values);
+	if(!SubscriptionListAdd(battery_subscriptions, sh, message, values))
+		return TRUE;
 
 	POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
 	LSError lserror;
 	LSErrorInit(&lserror);
-    bool retVal = LSMessageReply(sh, message, payload,NULL);
+	bool retVal = LSMessageReply(sh, message, payload, &lserror);
 	if (!retVal)
 	{
 		LSErrorPrint(&lserror, stderr);
 		LSErrorFree(&lserror);
 	}
-	g_free(payload);
 	return TRUE;
 }
 
+/**
+ * @brief Report how many battery reads the sample cache served, see battery_sample_cache_stats().
+ */
+bool batterySampleCacheQuery(LSHandle *sh,
+                   LSMessage *message, void *user_data)
+{
+	guint hits = 0, misses = 0;
+
+	battery_sample_cache_stats(&hits, &misses);
+
+	char *payload = g_strdup_printf("{\"returnValue\":true,\"hits\":%u,\"misses\":%u,"
+	                                "\"window_ms\":%d}",
+	                                hits, misses, gChargeConfig.battery_sample_window_ms);
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, payload, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+	g_free(payload);
+	return true;
+}
+
 void machineShutdown(void)
 {
 	char *payload = g_strdup_printf("{\"reason\":\"Battery level is critical\"}");
@@ -235,41 +760,12 @@ void machineShutdown(void)
 	}
 }
 
-void sendBatteryStatus(void)
+/**
+ * @brief Send the batteryStatus signal for a state already read.
+ */
+static void battery_status_send(nyx_battery_status_t *status)
 {
-	nyx_battery_status_t status;
-	if(!battDev)
-		return;
-
-	nyx_error_t err = nyx_battery_query_battery_status(battDev,&status);
-
-	if(err != NYX_ERROR_NONE)
-	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_battery_status returned with error : %d",__func__,err);
-	}
-
-	int percent_ui = getUiPercent(status.percentage);
-
-
-	POWERDLOG(LOG_INFO,
-			"(%fmAh, %d%%, %d%%_ui, %dC, %dmA, %dmV)\n",
-			status.capacity, status.percentage,
-			percent_ui,
-			status.temperature,
-			status.current, status.voltage);
-
-	GString *buffer = g_string_sized_new(500);
-	g_string_append_printf(buffer,"{\"percent\":%d,\"percent_ui\":%d,"
-				"\"temperature_C\":%d,\"current_mA\":%d,\"voltage_mV\":%d,"
-				"\"capacity_mAh\":%f}",
-		status.percentage,
-		percent_ui,
-		status.temperature,
-		status.current,
-		status.voltage,
-		status.capacity);
-
-	char *payload = g_string_free(buffer, FALSE);
+	const char *payload = battery_status_payload(status);
 
 	POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
 	LSError lserror;
@@ -283,14 +779,45 @@ void sendBatteryStatus(void)
 		LSErrorFree(&lserror);
 	}
 
-	g_free(payload);
-	return;
+	battery_signal_emitted(status);
+	battery_subscriptions_notify(status);
+}
+
+void sendBatteryStatus(void)
+{
+	nyx_battery_status_t status = {0};
+	if(!battery_device_num)
+		return;
+
+	battery_read(&status);
+	battery_status_send(&status);
+}
+
+/**
+ * @brief Send the batteryStatus signal if the signal emission policy considers the current
+ * sample worth broadcasting.
+ */
+void sendBatteryStatusIfSignificant(void)
+{
+	nyx_battery_status_t status = {0};
+	if(!battery_device_num)
+		return;
+
+	battery_read(&status);
+	if(battery_signal_should_emit(&status))
+		sendBatteryStatus();
+	else
+		battery_subscriptions_notify(&status);
 }
 
 
 void notifyBatteryStatus(nyx_device_handle_t handle, nyx_callback_status_t status, void* data)
 {
-	sendBatteryStatus();
+	int i = GPOINTER_TO_INT(data);
+
+	if(i >= 0 && i < battery_device_num)
+		battery_devices[i].stale = true;
+	sendBatteryStatusIfSignificant();
 }
 
 bool batteryStatusQuerySignal(LSHandle *sh,
@@ -398,7 +925,7 @@ end:
 
 int BatteryInit(void)
 {
-	int ret = 0;
+	int ret = 0, i;
 	nyx_error_t error = NYX_ERROR_NONE;
 	nyx_device_iterator_handle_t iteraror = NULL;
 
@@ -414,15 +941,32 @@ int BatteryInit(void)
 			&id)) == NYX_ERROR_NONE && NULL != id)
 		{
 			g_debug("Powerd: Battery device id \"%s\" found",id);
-			error = nyx_device_open(NYX_DEVICE_BATTERY, id, &battDev);
+			if(battery_device_num == BATTERY_MAX_DEVICES)
+			{
+				POWERDLOG(LOG_WARNING,"Ignoring battery device \"%s\", already using %d",
+						id,BATTERY_MAX_DEVICES);
+				continue;
+			}
+
+			struct battery_device *dev = &battery_devices[battery_device_num];
+
+			error = nyx_device_open(NYX_DEVICE_BATTERY, id, &dev->handle);
 			if(error != NYX_ERROR_NONE)
 			{
-				goto error;
+				POWERDLOG(LOG_ERR,"Could not open battery device \"%s\" : %d",id,error);
+				continue;
 			}
-			break;
+			g_strlcpy(dev->id, id, sizeof(dev->id));
+			battery_device_num++;
 		}
 	}
 
+	if(battery_device_num == 0)
+		goto error;
+
+	battery_subscriptions = SubscriptionListNew("batteryStatusQuery",
+			battery_subscription_fields, G_N_ELEMENTS(battery_subscription_fields), 0);
+
 	LSError lserror;
 	LSErrorInit(&lserror);
 	bool retVal;
@@ -446,7 +990,9 @@ int BatteryInit(void)
         if (!retVal) goto lserror;
     }
 
-	nyx_battery_register_battery_status_callback(battDev,notifyBatteryStatus,NULL);
+	for(i = 0; i < battery_device_num; i++)
+		nyx_battery_register_battery_status_callback(battery_devices[i].handle,
+				notifyBatteryStatus,GINT_TO_POINTER(i));
 
 out:
 	if(iteraror)
@@ -461,7 +1007,7 @@ lserror:
 
 error:
 	g_critical("Powerd: No battery device found\n");
-	battDev = NULL;
+	battery_device_num = 0;
 	if(iteraror)
 		free(iteraror);
 //	abort();
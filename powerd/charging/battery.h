@@ -18,6 +18,7 @@
 
 
 #include <stdbool.h>
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 
 #include <nyx/nyx_client.h>
@@ -29,6 +30,9 @@
  * Structures
  */
 
+/* @brief Maximum number of nyx battery devices (main pack, dock pack, keyboard pack...) tracked. */
+#define BATTERY_MAX_DEVICES	4
+
 extern struct battery_charge battery_params;
 
 void BatteryCheckReason(int batterycheck);
@@ -56,7 +60,12 @@ double battery_get_age(void);
 
 const char * battery_status(void);
 
+int battery_device_count(void);
 void battery_read(nyx_battery_status_t *state);
+void battery_read_device(int device, nyx_battery_status_t *state);
+bool battery_authenticate_device(int device);
+void battery_sample_invalidate(void);
+void battery_sample_cache_stats(guint *hits, guint *misses);
 void battery_set_empty(nyx_battery_status_t *state);
 
 void battery_search(bool on);
@@ -72,6 +81,7 @@ void battery_init_wakeup_params(void);
  */
 
 bool batteryStatusQuery(LSHandle *sh, LSMessage *message, void *user_data);
+bool batterySampleCacheQuery(LSHandle *sh, LSMessage *message, void *user_data);
 
 /**
  * Lunabus signals
@@ -79,5 +89,6 @@ bool batteryStatusQuery(LSHandle *sh, LSMessage *message, void *user_data);
 
 int SendBatteryNotification(bool significant);
 void sendBatteryStatus(void);
+void sendBatteryStatusIfSignificant(void);
 
 #endif // __BATTERY_H__
@@ -0,0 +1,123 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file batteryestimate.c
+ *
+ * @brief Time to empty / time to full estimation.
+ *
+ * Keeps an exponentially weighted moving average of the battery current, weighted by the time elapsed
+ * between samples, and derives the remaining minutes until the battery is empty (when discharging) or
+ * full (when charging) from the remaining and full capacity reported by the fuel gauge. Each sample
+ * costs O(1).
+ */
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "clock.h"
+#include "config.h"
+#include "logging.h"
+#include "batteryestimate.h"
+
+#define LOG_DOMAIN "BATTERY_ESTIMATE: "
+
+/* @brief Below this average current (mA) the battery is considered idle and nothing is estimated. */
+#define ESTIMATE_MIN_CURRENT_MA	5
+
+static struct {
+	double          avg_current_mA;
+	struct timespec last_sample;
+	bool            valid;
+
+	int             minutes_to_empty;
+	int             minutes_to_full;
+} battery_estimate = {
+	.minutes_to_empty = -1,
+	.minutes_to_full = -1,
+};
+
+/**
+ * @brief Fold a new gauge sample into the current average and refresh the estimates.
+ */
+void
+battery_estimate_update(nyx_battery_status_t *status)
+{
+	struct timespec now, elapsed;
+
+	ClockGetTime(&now);
+
+	if (!battery_estimate.valid)
+	{
+		battery_estimate.avg_current_mA = status->current;
+		battery_estimate.valid = true;
+	}
+	else
+	{
+		ClockDiff(&elapsed, &now, &battery_estimate.last_sample);
+
+		double dt = ClockGetMs(&elapsed) / 1000.0;
+		double tau = MAX(gChargeConfig.estimate_time_constant_s, 1);
+		double alpha = dt / (tau + dt);
+
+		battery_estimate.avg_current_mA += alpha * (status->current - battery_estimate.avg_current_mA);
+	}
+	battery_estimate.last_sample = now;
+
+	double full_mAh = status->capacity_full40;
+	if (status->age > 0)
+		full_mAh = full_mAh * status->age / 100;
+
+	battery_estimate.minutes_to_empty = -1;
+	battery_estimate.minutes_to_full = -1;
+
+	if (battery_estimate.avg_current_mA < -ESTIMATE_MIN_CURRENT_MA)
+	{
+		battery_estimate.minutes_to_empty =
+			status->capacity * 60 / -battery_estimate.avg_current_mA;
+	}
+	else if (battery_estimate.avg_current_mA > ESTIMATE_MIN_CURRENT_MA && full_mAh > 0)
+	{
+		battery_estimate.minutes_to_full =
+			MAX(full_mAh - status->capacity, 0) * 60 / battery_estimate.avg_current_mA;
+	}
+
+	POWERDLOG(LOG_DEBUG, "%s: avg %.1fmA, to empty %d min, to full %d min", __func__,
+			battery_estimate.avg_current_mA,
+			battery_estimate.minutes_to_empty,
+			battery_estimate.minutes_to_full);
+}
+
+/**
+ * @brief Estimated minutes until the battery is empty, or -1 if it is not discharging.
+ */
+int
+battery_estimate_minutes_to_empty(void)
+{
+	return battery_estimate.minutes_to_empty;
+}
+
+/**
+ * @brief Estimated minutes until the battery is full, or -1 if it is not charging.
+ */
+int
+battery_estimate_minutes_to_full(void)
+{
+	return battery_estimate.minutes_to_full;
+}
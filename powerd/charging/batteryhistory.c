@@ -0,0 +1,153 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file batteryhistory.c
+ *
+ * @brief Fixed size in-memory history of the battery samples read from the fuel gauge.
+ *
+ * Every sample battery_read() gets from the gauge is stored as a compact binary record in a
+ * statically allocated ring, so keeping the history never allocates. The history is served by
+ * luna://com.palm.power/com/palm/power/batteryHistory, which takes the following optional parameters:
+ *
+ * from  : oldest sample to return, in seconds of monotonic time (default 0).
+ * to    : newest sample to return, in seconds of monotonic time (default now).
+ * step  : return at most one sample every "step" seconds (default 0, all samples).
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "clock.h"
+#include "logging.h"
+#include "lunaservice_utils.h"
+#include "batteryhistory.h"
+
+#define LOG_DOMAIN "BATTERY_HISTORY: "
+
+static struct {
+	BatteryHistoryRecord records[BATTERY_HISTORY_SIZE];
+	guint                head;	/* next slot to write */
+	guint                count;
+} battery_history;
+
+static guint32
+battery_history_now(void)
+{
+	struct timespec now;
+
+	ClockGetTime(&now);
+	return (guint32)now.tv_sec;
+}
+
+/**
+ * @brief Append a sample to the history, overwriting the oldest record once the ring is full.
+ */
+void
+battery_history_add(nyx_battery_status_t *status, ChargePhase phase)
+{
+	BatteryHistoryRecord *record = &battery_history.records[battery_history.head];
+
+	record->timestamp = battery_history_now();
+	record->percentage = CLAMP(status->percentage, G_MININT8, G_MAXINT8);
+	record->temperature = CLAMP(status->temperature, G_MININT8, G_MAXINT8);
+	record->current_mA = CLAMP(status->current, G_MININT16, G_MAXINT16);
+	record->voltage_mV = CLAMP(status->voltage, 0, G_MAXUINT16);
+	record->capacity_mAh = CLAMP(status->capacity, 0, G_MAXUINT16);
+	record->phase = phase;
+
+	battery_history.head = (battery_history.head + 1) % BATTERY_HISTORY_SIZE;
+	if (battery_history.count < BATTERY_HISTORY_SIZE)
+		battery_history.count++;
+}
+
+static int
+json_get_int_default(struct json_object *object, const char *key, int value)
+{
+	struct json_object *child = json_object_object_get(object, key);
+
+	return child ? json_object_get_int(child) : value;
+}
+
+/**
+ * @brief Reply with the recorded battery samples within the requested time range.
+ */
+bool
+batteryHistoryQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+	{
+		LSMessageReplyErrorBadJSON(sh, message);
+		return true;
+	}
+
+	guint32 now = battery_history_now();
+	guint32 from = json_get_int_default(object, "from", 0);
+	guint32 to = json_get_int_default(object, "to", now);
+	guint32 step = json_get_int_default(object, "step", 0);
+
+	json_object_put(object);
+
+	GString *buffer = g_string_sized_new(64 + battery_history.count * 32);
+	g_string_append_printf(buffer, "{\"returnValue\":true,\"now\":%u,\"samples\":[", now);
+
+	guint oldest = (battery_history.head + BATTERY_HISTORY_SIZE - battery_history.count)
+	               % BATTERY_HISTORY_SIZE;
+	bool first = true;
+	guint32 next_timestamp = from;
+	guint i;
+
+	for (i = 0; i < battery_history.count; i++)
+	{
+		BatteryHistoryRecord *record =
+			&battery_history.records[(oldest + i) % BATTERY_HISTORY_SIZE];
+
+		if (record->timestamp < next_timestamp)
+			continue;
+		if (record->timestamp > to)
+			break;
+
+		g_string_append_printf(buffer, "%s{\"t\":%u,\"percent\":%d,\"temperature_C\":%d,"
+				"\"current_mA\":%d,\"voltage_mV\":%u,\"capacity_mAh\":%u,\"phase\":\"%s\"}",
+				first ? "" : ",",
+				record->timestamp, record->percentage, record->temperature,
+				record->current_mA, record->voltage_mV, record->capacity_mAh,
+				ChargePhaseName(record->phase));
+		first = false;
+
+		if (step)
+			next_timestamp = record->timestamp + step;
+	}
+
+	g_string_append(buffer, "]}");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
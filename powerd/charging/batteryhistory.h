@@ -0,0 +1,54 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _BATTERYHISTORY_H_
+#define _BATTERYHISTORY_H_
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include <nyx/nyx_client.h>
+
+#include "charging_logic.h"
+
+/**
+ * @brief Number of samples kept in the battery history ring.
+ */
+#define BATTERY_HISTORY_SIZE	2048
+
+/**
+ * @brief Compact battery history record (16 bytes).
+ */
+typedef struct {
+	guint32 timestamp;	/* seconds on the monotonic clock */
+	gint16  current_mA;
+	guint16 voltage_mV;
+	guint16 capacity_mAh;
+	gint8   percentage;
+	gint8   temperature;
+	guint8  phase;		/* ChargePhase */
+} BatteryHistoryRecord;
+
+G_STATIC_ASSERT(sizeof(BatteryHistoryRecord) == 16);
+
+void battery_history_add(nyx_battery_status_t *status, ChargePhase phase);
+
+bool batteryHistoryQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _BATTERYHISTORY_H_
@@ -59,6 +59,8 @@
 #include "logging.h"
 #include "utils/sysfs.h"
 #include "init.h"
+#include "main.h"
+#include "statemachine.h"
 
 #define LOG_DOMAIN "BATTERYPOLL: "
 
@@ -73,7 +75,7 @@ enum {
 };
 typedef int BatteryState;
 
-static char *debug_battery_state[] =
+static const char *debug_battery_state[] =
 {
     "removed",
     "debounce",
@@ -83,43 +85,76 @@ static char *debug_battery_state[] =
     "last",
 };
 
-typedef BatteryState (*BatteryStateProc)(void);
+static BatteryState StateRemoved(gpointer data);
+static BatteryState StateDebounce(gpointer data);
+static BatteryState StateInserted(gpointer data);
+static BatteryState StateAuthentic(gpointer data);
+static BatteryState StateNotAuthentic(gpointer data);
+
+static const StateFunc kStateFunctions[kBatteryLast] = {
+    [kBatteryRemoved]      = StateRemoved,
+    [kBatteryDebounce]     = StateDebounce,
+    [kBatteryInserted]     = StateInserted,
+    [kBatteryAuthentic]    = StateAuthentic,
+    [kBatteryNotAuthentic] = StateNotAuthentic,
+};
 
-typedef struct {
-    BatteryState     state;
-    BatteryStateProc function;
-} BatteryStateNode;
-
-static BatteryState StateRemoved(void);
-static BatteryState StateDebounce(void);
-static BatteryState StateInserted(void);
-static BatteryState StateAuthentic(void);
-static BatteryState StateNotAuthentic(void);
-
-static const BatteryStateNode kStateMachine[] = {
-    { kBatteryRemoved, StateRemoved },
-    { kBatteryDebounce, StateDebounce },
-    { kBatteryInserted, StateInserted },
-    { kBatteryAuthentic, StateAuthentic },
-    { kBatteryNotAuthentic, StateNotAuthentic },
+static const StateTransition kStateTransitions[] = {
+    { kBatteryRemoved,      kBatteryInserted },
+    { kBatteryDebounce,     kBatteryInserted },
+    { kBatteryDebounce,     kBatteryRemoved },
+    { kBatteryInserted,     kBatteryAuthentic },
+    { kBatteryInserted,     kBatteryNotAuthentic },
+    { kBatteryAuthentic,    kBatteryDebounce },
+    { kBatteryNotAuthentic, kBatteryAuthentic },
+    { kBatteryNotAuthentic, kBatteryDebounce },
+};
+
+static void battery_state_log(int state, gpointer data);
+
+/* @brief Shared by the state machines of all battery devices, the device index is the data. */
+static StateMachine kStateMachine = {
+    .name = "battery",
+    .state_names = debug_battery_state,
+    .functions = kStateFunctions,
+    .num_states = kBatteryLast,
+    .transitions = kStateTransitions,
+    .num_transitions = G_N_ELEMENTS(kStateTransitions),
+    .step = battery_state_log,
 };
 
 /* @brief when bad samples > threshold, mark battery as removed. */
 #define BAD_SAMPLES_THRESHOLD	3
 
-static BatteryStateNode state_node;
+/**
+ * @brief State machine of one battery device. Device 0 is the main pack.
+ */
+typedef struct {
+    BatteryState     state;
+    BatteryState     last_logged;
+    int              debounce_bad;
+    int              discharge_count;
+} BatteryMachine;
+
+static BatteryMachine battery_machines[BATTERY_MAX_DEVICES];
+static int battery_machine_num = 0;
+
+/* @brief Set by the "authentic" states when a device was sampled during the current iteration. */
+static bool battery_status_pending = false;
 
 extern struct battery_charge battery_params;
 
 #define MAX_DISCHARGE_COUNT	25
 
-static int discharge_count = 0;
-
 /**
  * @defgroup Battery Battery
  * @ingroup Charging
  * @brief Battery State Machine :
  *
+ * Every battery device runs its own instance of the state machine below. Removal of the main
+ * pack (the first device) is what BatteryIsPresent() reports, a secondary pack (dock, keyboard)
+ * coming and going does not affect it.
+ *
  * 1. Removed: This state implies the battery is disconnected from the system.
  *
  * 2. Inserted : In the "removed" state if battery is detected ( if battery voltage is positive), then the
@@ -148,19 +183,35 @@ static int discharge_count = 0;
 
 
 /**
- * @brief Check if the current battery state is "Authentic".
+ * @brief Check if the battery is authentic : the main pack and every other pack present.
  */
 bool BatteryIsAuthentic(void)
 {
-    return state_node.state == kBatteryAuthentic;
+    int i;
+
+    if (battery_machine_num == 0)
+        return false;
+
+    for (i = 0; i < battery_machine_num; i++)
+    {
+        BatteryState state = battery_machines[i].state;
+
+        if (i == 0 || state != kBatteryRemoved)
+            if (state != kBatteryAuthentic)
+                return false;
+    }
+    return true;
 }
 
 /**
- * @brief Check if the battery is present by comparing the current battery state to "removed" state.
+ * @brief Check if the main battery is present by comparing its state to "removed" state.
  */
 bool BatteryIsPresent(void)
 {
-    return state_node.state != kBatteryRemoved;
+    if (battery_machine_num == 0)
+        return true;
+
+    return battery_machines[0].state != kBatteryRemoved;
 }
 
 /**
@@ -172,79 +223,79 @@ bool battery_present_sample(nyx_battery_status_t *state)
 }
 
 /**
- * @brief The current battery percentage and temperature are compared to the ones from the last reading
- * and if any one of them have changed, implies the current sample is significant and should be reported
- * to the system.
+ * @brief The battery poll state machines are initialized to start from the "debounce" state.
  */
-static bool sample_is_new(nyx_battery_status_t *state)
+static void battery_state_init()
 {
-    static nyx_battery_status_t last = {0};
-    bool percentChange = abs(state->percentage - last.percentage) > 0;
-    bool tempChange = abs(state->temperature - last.temperature) > 1;
+    int i;
 
-    if (percentChange || tempChange) {
-        last = *state;
-        return true;
+    battery_machine_num = battery_device_count();
+    for (i = 0; i < battery_machine_num; i++)
+    {
+        battery_machines[i].state = kBatteryDebounce;
+        battery_machines[i].last_logged = kBatteryLast;
+        battery_machines[i].debounce_bad = 0;
+        battery_machines[i].discharge_count = 0;
     }
-    return false;
-}
-
-/**
- * @brief The battery poll state machine is initialized to start from the "debounce" state.
- */
-static void battery_state_init()
-{
-    state_node = kStateMachine[kBatteryDebounce];
 }
 
 
 /**
  * @brief Log the current state.
  */
-static void battery_state_log()
+static void battery_state_log(int state, gpointer data)
 {
-    static BatteryState last_state = kBatteryLast;
-    if (last_state != state_node.state) {
-        POWERDLOG(LOG_INFO, "BatteryState %s",
-            debug_battery_state[state_node.state]);
-        last_state = state_node.state;
+    int device = GPOINTER_TO_INT(data);
+    BatteryMachine *machine = &battery_machines[device];
+
+    if (machine->last_logged != state) {
+        POWERDLOG(LOG_INFO, "BatteryState[%d] %s", device,
+            debug_battery_state[state]);
+        machine->last_logged = state;
     }
 }
 
 
 /**
- * @brief Iterate through the battery poll state machine.
+ * @brief Iterate through the battery poll state machine of every device.
  *
+ * The batteryStatus signal is considered once per iteration, with the combined state of all
+ * devices, rather than once per device.
  */
 void battery_state_iterate()
 {
-    BatteryState next_state;
-    do {
-        battery_state_log();
-        next_state = state_node.function();
-        if (kBatteryLast != next_state) {
-            state_node = kStateMachine[next_state];
-        }
-    } while (kBatteryLast != next_state);
+    int i;
+
+    battery_status_pending = false;
+
+    for (i = 0; i < battery_machine_num; i++)
+        StateMachineRun(&kStateMachine, &battery_machines[i].state, GINT_TO_POINTER(i));
+
+    if (battery_status_pending)
+        sendBatteryStatusIfSignificant();
+
+    ChargingLogicThermalCheck();
+    ChargingLogicCurrentLimitUpdate();
 }
 
 /**
  * @brief State "debounce".
  */
 
-static BatteryState StateDebounce(void)
+static BatteryState StateDebounce(gpointer data)
 {
-    static int debounce_bad = 0;
-    nyx_battery_status_t battery;
+    int device = GPOINTER_TO_INT(data);
+    BatteryMachine *machine = &battery_machines[device];
+    nyx_battery_status_t battery = {0};
 
-    battery_read(&battery);
+    battery_read_device(device, &battery);
     if (battery.present) {
-        debounce_bad = 0;
+        machine->debounce_bad = 0;
         return kBatteryInserted;
     }
-    else if (++debounce_bad > BAD_SAMPLES_THRESHOLD) {
+    else if (++machine->debounce_bad > BAD_SAMPLES_THRESHOLD) {
 
-        POWERDLOG(LOG_INFO, "Battery has been removed.\n");
+        POWERDLOG(LOG_INFO, "Battery %d has been removed.\n", device);
         battery_search(true);
         return kBatteryRemoved;
     }
@@ -254,11 +305,12 @@ static BatteryState StateDebounce(void)
 /**
  * @brief State "removed".
  */
-static BatteryState StateRemoved(void)
+static BatteryState StateRemoved(gpointer data)
 {
-    nyx_battery_status_t battery;
+    int device = GPOINTER_TO_INT(data);
+    nyx_battery_status_t battery = {0};
 
-    battery_read(&battery);
+    battery_read_device(device, &battery);
 
     if (battery.present)
         return kBatteryInserted;
@@ -269,15 +321,16 @@ static BatteryState StateRemoved(void)
 /**
  * @brief State "inserted".
  */
-static BatteryState StateInserted(void)
+static BatteryState StateInserted(gpointer data)
 {
+    int device = GPOINTER_TO_INT(data);
     battery_search(false);
 
-    if (battery_authenticate()) {
+    if (battery_authenticate_device(device)) {
         return kBatteryAuthentic;
     }
     else {
-    	POWERDLOG(LOG_CRIT,"Battery authentication failure");
+    	POWERDLOG(LOG_CRIT,"Battery %d authentication failure", device);
         return kBatteryNotAuthentic;
     }
 }
@@ -286,24 +339,25 @@ static BatteryState StateInserted(void)
  * @brief Function called from both the states "authentic" and "notauthentic".
  */
 
-static BatteryState StateAuthenticOrNot(void)
+static BatteryState StateAuthenticOrNot(int device)
 {
-    nyx_battery_status_t battery;
+    BatteryMachine *machine = &battery_machines[device];
+    nyx_battery_status_t battery = {0};
 
-    battery_read(&battery);
+    battery_read_device(device, &battery);
 
     if(ChargerIsCharging() && battery.current <= 0 )
     {
-    	POWERDLOG(LOG_INFO,"%d: BATTERY DISCHARGING ....",discharge_count);
-    	discharge_count++;
+    	POWERDLOG(LOG_INFO,"%d: BATTERY %d DISCHARGING ....",machine->discharge_count,device);
+    	machine->discharge_count++;
     }
     else
-    	discharge_count = 0;
+    	machine->discharge_count = 0;
 
-    if(discharge_count == MAX_DISCHARGE_COUNT)
+    if(machine->discharge_count == MAX_DISCHARGE_COUNT)
     {
-    	POWERDLOG(LOG_CRIT,"Battery discharging while on charger");
-        discharge_count = 0;
+    	POWERDLOG(LOG_CRIT,"Battery %d discharging while on charger",device);
+        machine->discharge_count = 0;
     }
 
     if(!battery.present)
@@ -311,8 +365,7 @@ static BatteryState StateAuthenticOrNot(void)
         return kBatteryDebounce;
     }
 
-    if(sample_is_new(&battery))
-    	sendBatteryStatus();
+    battery_status_pending = true;
 
     return kBatteryLast;
 }
@@ -320,31 +373,119 @@ static BatteryState StateAuthenticOrNot(void)
 /**
  * @brief State "notauthentic".
  */
-static BatteryState StateNotAuthentic(void)
+static BatteryState StateNotAuthentic(gpointer data)
 {
-    if (battery_authenticate()) {
+    int device = GPOINTER_TO_INT(data);
+    if (battery_authenticate_device(device)) {
         return kBatteryAuthentic;
     }
     else
-    	POWERDLOG(LOG_CRIT,"Battery authentication failure");
+    	POWERDLOG(LOG_CRIT,"Battery %d authentication failure", device);
 
-    return StateAuthenticOrNot();
+    return StateAuthenticOrNot(device);
 }
 
 /**
  * @brief State "authentic".
  */
-static BatteryState StateAuthentic(void)
+static BatteryState StateAuthentic(gpointer data)
+{
+	return StateAuthenticOrNot(GPOINTER_TO_INT(data));
+}
+
+/**
+ * @brief Adaptive battery poll.
+ *
+ * Not every gauge driver reliably raises nyx callbacks, so the battery is also polled from a
+ * GTimerSource. The poll interval doubles (up to [battery] poll_max_interval_s) while readings are
+ * stable and drops back to poll_min_interval_s while charging, while the temperature is rising, when
+ * the level is low or the temperature close to the shutdown limit.
+ */
+
+/* @brief Granularity of the poll timer, so that it expires together with other wakeups. */
+#define BATTERY_POLL_GRANULARITY_MS	1000
+
+/* @brief The poll is tightened below this battery percentage. */
+#define BATTERY_POLL_LOW_PERCENT	10
+
+/* @brief The poll is tightened within this many degrees of the maximum battery temperature. */
+#define BATTERY_POLL_TEMPERATURE_MARGIN_C	5
+
+static GTimerSource *battery_poll_source = NULL;
+
+/* @brief poll_min_interval_s, at least a second: a 0ms timer source would spin the main loop. */
+static guint
+battery_poll_min_ms(void)
+{
+    return MAX(gChargeConfig.poll_min_interval_s, 1) * 1000;
+}
+
+static guint
+battery_poll_next_interval(nyx_battery_status_t *battery)
 {
-	return StateAuthenticOrNot();
+    static nyx_battery_status_t last;
+    static bool have_last = false;
+
+    guint min_ms = battery_poll_min_ms();
+    guint max_ms = MAX(gChargeConfig.poll_max_interval_s * 1000, min_ms);
+    guint interval = g_timer_source_get_interval_ms(battery_poll_source);
+
+    bool rising = have_last && battery->temperature > last.temperature;
+    bool stable = have_last && battery->percentage == last.percentage &&
+                  abs(battery->temperature - last.temperature) < 1;
+    bool near_threshold = battery->percentage <= BATTERY_POLL_LOW_PERCENT ||
+        battery->temperature >= batterycheck_maxtemp() - BATTERY_POLL_TEMPERATURE_MARGIN_C;
+
+    last = *battery;
+    have_last = true;
+
+    if (ChargerIsCharging() || rising || near_threshold)
+        return min_ms;
+    if (stable)
+        return CLAMP(interval * 2, min_ms, max_ms);
+    return CLAMP(interval, min_ms, max_ms);
+}
+
+static gboolean
+battery_poll(gpointer data)
+{
+    nyx_battery_status_t battery = {0};
+
+    battery_sample_invalidate();
+    battery_state_iterate();
+
+    battery_read(&battery);
+
+    guint interval = battery_poll_next_interval(&battery);
+    if (interval != g_timer_source_get_interval_ms(battery_poll_source))
+    {
+        POWERDLOG(LOG_DEBUG, "Battery poll interval %ums", interval);
+        g_timer_source_set_interval(battery_poll_source, interval, TRUE);
+    }
+
+    return TRUE;
+}
+
+static void
+battery_poll_start(void)
+{
+    if (gChargeConfig.poll_max_interval_s <= 0)
+        return;
+
+    battery_poll_source = g_timer_source_new(battery_poll_min_ms(), BATTERY_POLL_GRANULARITY_MS);
+
+    g_source_set_callback((GSource*)battery_poll_source, battery_poll, NULL, NULL);
+    g_source_attach((GSource*)battery_poll_source, GetMainLoopContext());
 }
 
 int batterypoll_init(void)
 {
+    StateMachineRegister(&kStateMachine);
     battery_state_init();
 
     battery_state_iterate();
-    discharge_count = 0;
+
+    battery_poll_start();
     return 0;
 }
 
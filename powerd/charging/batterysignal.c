@@ -0,0 +1,200 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file batterysignal.c
+ *
+ * @brief Emission policy for the batteryStatus signal.
+ *
+ * A new sample is only broadcast if one of its fields moved past its deadband since the last signal
+ * that went out ([battery] signal_deadband_* in powerd.conf, 0 ignores the field). Significant samples
+ * arriving within signal_min_interval_ms of the previous signal are held back and sent once the
+ * interval has elapsed. If nothing was sent for signal_max_interval_s, the current sample is sent as
+ * a heartbeat.
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "clock.h"
+#include "config.h"
+#include "logging.h"
+#include "battery.h"
+#include "batterysignal.h"
+
+#define LOG_DOMAIN "BATTERY_SIGNAL: "
+
+static struct {
+	nyx_battery_status_t last;
+	struct timespec      last_time;
+	bool                 valid;
+
+	guint                deferred_source;
+	guint                heartbeat_source;
+
+	guint                emitted;
+	guint                suppressed;
+} battery_signal;
+
+static bool
+exceeds_deadband(int a, int b, int deadband)
+{
+	return deadband > 0 && abs(a - b) >= deadband;
+}
+
+static bool
+battery_signal_is_significant(nyx_battery_status_t *status)
+{
+	nyx_battery_status_t *last = &battery_signal.last;
+
+	if (!battery_signal.valid || status->present != last->present)
+		return true;
+
+	return exceeds_deadband(status->percentage, last->percentage,
+	                        gChargeConfig.signal_deadband_percent) ||
+	       exceeds_deadband(status->temperature, last->temperature,
+	                        gChargeConfig.signal_deadband_temperature_c) ||
+	       exceeds_deadband(status->voltage, last->voltage,
+	                        gChargeConfig.signal_deadband_voltage_mv) ||
+	       exceeds_deadband(status->current, last->current,
+	                        gChargeConfig.signal_deadband_current_ma);
+}
+
+static gboolean
+battery_signal_deferred(gpointer data)
+{
+	battery_signal.deferred_source = 0;
+	sendBatteryStatus();
+	return FALSE;
+}
+
+static gboolean
+battery_signal_heartbeat(gpointer data)
+{
+	battery_signal.heartbeat_source = 0;
+	POWERDLOG(LOG_DEBUG, "No batteryStatus for %ds, sending heartbeat",
+	          gChargeConfig.signal_max_interval_s);
+	sendBatteryStatus();
+	return FALSE;
+}
+
+/**
+ * @brief Decide whether a new sample should be broadcast right away.
+ *
+ * Returns false for samples within the deadbands and for significant samples arriving too early; the
+ * latter are sent later from a timeout.
+ */
+bool
+battery_signal_should_emit(nyx_battery_status_t *status)
+{
+	struct timespec now, elapsed;
+
+	if (!battery_signal_is_significant(status))
+	{
+		battery_signal.suppressed++;
+		return false;
+	}
+
+	if (battery_signal.valid && gChargeConfig.signal_min_interval_ms > 0)
+	{
+		ClockGetTime(&now);
+		ClockDiff(&elapsed, &now, &battery_signal.last_time);
+
+		long remaining_ms = gChargeConfig.signal_min_interval_ms - ClockGetMs(&elapsed);
+		if (remaining_ms > 0)
+		{
+			battery_signal.suppressed++;
+			if (!battery_signal.deferred_source)
+			{
+				battery_signal.deferred_source =
+				    g_timeout_add(remaining_ms, battery_signal_deferred, NULL);
+			}
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Record a batteryStatus signal that has just been sent.
+ */
+void
+battery_signal_emitted(nyx_battery_status_t *status)
+{
+	battery_signal.last = *status;
+	battery_signal.valid = true;
+	ClockGetTime(&battery_signal.last_time);
+	battery_signal.emitted++;
+
+	if (battery_signal.deferred_source)
+	{
+		g_source_remove(battery_signal.deferred_source);
+		battery_signal.deferred_source = 0;
+	}
+
+	if (battery_signal.heartbeat_source)
+	{
+		g_source_remove(battery_signal.heartbeat_source);
+		battery_signal.heartbeat_source = 0;
+	}
+
+	if (gChargeConfig.signal_max_interval_s > 0)
+	{
+		battery_signal.heartbeat_source = g_timeout_add_seconds(
+		    gChargeConfig.signal_max_interval_s, battery_signal_heartbeat, NULL);
+	}
+
+	POWERDLOG(LOG_DEBUG, "batteryStatus signals emitted %u, suppressed %u",
+	          battery_signal.emitted, battery_signal.suppressed);
+}
+
+/**
+ * @brief Return the number of batteryStatus signals sent and held back by the policy.
+ */
+void
+battery_signal_stats(guint *emitted, guint *suppressed)
+{
+	if (emitted)
+		*emitted = battery_signal.emitted;
+	if (suppressed)
+		*suppressed = battery_signal.suppressed;
+}
+
+bool
+batterySignalStatsQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	guint emitted = 0, suppressed = 0;
+
+	battery_signal_stats(&emitted, &suppressed);
+
+	char *payload = g_strdup_printf("{\"returnValue\":true,\"emitted\":%u,\"suppressed\":%u}",
+	                                emitted, suppressed);
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, payload, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+	g_free(payload);
+	return true;
+}
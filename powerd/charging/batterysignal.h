@@ -0,0 +1,36 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _BATTERYSIGNAL_H_
+#define _BATTERYSIGNAL_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include <nyx/nyx_client.h>
+
+bool battery_signal_should_emit(nyx_battery_status_t *status);
+void battery_signal_emitted(nyx_battery_status_t *status);
+
+void battery_signal_stats(guint *emitted, guint *suppressed);
+
+bool batterySignalStatsQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _BATTERYSIGNAL_H_
@@ -0,0 +1,167 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file batterythermal.c
+ *
+ * @brief Battery temperature trend.
+ *
+ * Keeps the temperature samples of the last THERMAL_WINDOW_S seconds and fits a least squares line
+ * through them, so the charging logic can tell how soon a temperature limit will be crossed instead
+ * of reacting once it has been. Slopes steeper than the expected maximum slew rate (--temprate, in
+ * degrees C per minute) are taken as gauge glitches and clamped to it.
+ */
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "clock.h"
+#include "config.h"
+#include "logging.h"
+#include "batterythermal.h"
+
+#define LOG_DOMAIN "BATTERY_THERMAL: "
+
+/* @brief Default expected maximum temperature slew rate, degrees C per minute. */
+#define THERMAL_DEFAULT_RATE	12
+
+/* @brief Only samples this recent are fitted. */
+#define THERMAL_WINDOW_S	300
+
+/* @brief A slope is only estimated from this many samples spanning at least THERMAL_MIN_SPAN_S. */
+#define THERMAL_MIN_SAMPLES	3
+#define THERMAL_MIN_SPAN_S	30
+
+#define THERMAL_MAX_SAMPLES	16
+
+/*
+ * @brief Samples are kept at least this far apart, so that a burst of gauge reads cannot push the
+ * window below THERMAL_MIN_SPAN_S. A sample closer to the previous one replaces the newest.
+ */
+#define THERMAL_SAMPLE_INTERVAL_MS	(THERMAL_MIN_SPAN_S * 1000 / 4)
+
+static struct {
+	struct timespec time[THERMAL_MAX_SAMPLES];
+	int             temperature[THERMAL_MAX_SAMPLES];
+	guint           head;	/* next slot to write */
+	guint           count;
+
+	double          slope;	/* degrees C per second */
+	int             temperature_now;
+	bool            valid;
+} battery_thermal;
+
+static double
+battery_thermal_max_rate(void)
+{
+	int rate = gChargeConfig.temprate ? gChargeConfig.temprate : THERMAL_DEFAULT_RATE;
+
+	return rate / 60.0;
+}
+
+/**
+ * @brief Add a gauge sample to the window and refit the temperature slope.
+ */
+void
+battery_thermal_update(nyx_battery_status_t *status)
+{
+	struct timespec now, age;
+	double sum_t = 0, sum_T = 0, sum_tt = 0, sum_tT = 0;
+	double span = 0;
+	guint i, n = 0;
+
+	ClockGetTime(&now);
+
+	if (battery_thermal.count >= 2)
+	{
+		guint previous = (battery_thermal.head + THERMAL_MAX_SAMPLES - 2) % THERMAL_MAX_SAMPLES;
+
+		ClockDiff(&age, &now, &battery_thermal.time[previous]);
+		if (ClockGetMs(&age) < THERMAL_SAMPLE_INTERVAL_MS)
+		{
+			battery_thermal.head = (battery_thermal.head + THERMAL_MAX_SAMPLES - 1) % THERMAL_MAX_SAMPLES;
+			battery_thermal.count--;
+		}
+	}
+
+	battery_thermal.time[battery_thermal.head] = now;
+	battery_thermal.temperature[battery_thermal.head] = status->temperature;
+	battery_thermal.head = (battery_thermal.head + 1) % THERMAL_MAX_SAMPLES;
+	if (battery_thermal.count < THERMAL_MAX_SAMPLES)
+		battery_thermal.count++;
+
+	battery_thermal.temperature_now = status->temperature;
+	battery_thermal.valid = false;
+
+	/* Fit T = a + slope * t, with t counted backwards from now so the sums stay small. */
+	for (i = 0; i < battery_thermal.count; i++)
+	{
+		guint slot = (battery_thermal.head + THERMAL_MAX_SAMPLES - 1 - i) % THERMAL_MAX_SAMPLES;
+
+		ClockDiff(&age, &now, &battery_thermal.time[slot]);
+		double t = -ClockGetMs(&age) / 1000.0;
+		if (-t > THERMAL_WINDOW_S)
+			break;
+
+		sum_t += t;
+		sum_T += battery_thermal.temperature[slot];
+		sum_tt += t * t;
+		sum_tT += t * battery_thermal.temperature[slot];
+		span = -t;
+		n++;
+	}
+
+	double denominator = n * sum_tt - sum_t * sum_t;
+	if (n < THERMAL_MIN_SAMPLES || span < THERMAL_MIN_SPAN_S || denominator <= 0)
+		return;
+
+	double max_rate = battery_thermal_max_rate();
+
+	battery_thermal.slope = CLAMP((n * sum_tT - sum_t * sum_T) / denominator, -max_rate, max_rate);
+	battery_thermal.valid = true;
+
+	POWERDLOG(LOG_DEBUG, "%s: %dC, %.2fC/min over %u samples", __func__,
+			status->temperature, battery_thermal.slope * 60, n);
+}
+
+/**
+ * @brief Return the temperature slope in degrees C per minute, false if there are too few samples.
+ */
+bool
+battery_thermal_slope(double *slope)
+{
+	if (battery_thermal.valid)
+		*slope = battery_thermal.slope * 60;
+	return battery_thermal.valid;
+}
+
+/**
+ * @brief Predicted seconds until the battery temperature reaches limit_C, 0 if it already has,
+ * -1 if it is not rising towards it.
+ */
+int
+battery_thermal_seconds_to(int limit_C)
+{
+	if (battery_thermal.temperature_now >= limit_C)
+		return 0;
+
+	if (!battery_thermal.valid || battery_thermal.slope <= 0)
+		return -1;
+
+	return (limit_C - battery_thermal.temperature_now) / battery_thermal.slope;
+}
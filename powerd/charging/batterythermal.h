@@ -0,0 +1,31 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _BATTERYTHERMAL_H_
+#define _BATTERYTHERMAL_H_
+
+#include <stdbool.h>
+#include <nyx/nyx_client.h>
+
+void battery_thermal_update(nyx_battery_status_t *status);
+
+bool battery_thermal_slope(double *slope);
+int battery_thermal_seconds_to(int limit_C);
+
+#endif // _BATTERYTHERMAL_H_
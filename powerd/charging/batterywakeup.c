@@ -0,0 +1,241 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file batterywakeup.c
+ *
+ * @brief Choice of the battery level the fuel gauge wakes the device up at while suspended.
+ *
+ * Without a history the gauge is armed at the next level of the wakeup table below the current
+ * one, as it always was. Once the discharge rate while suspended has been measured (from the
+ * level at suspend and at resume, timed with the RTC since the monotonic clock stops), the
+ * intermediate levels are skipped: the gauge is armed at the lowest table level that still
+ * leaves wakeup_margin_minutes of suspended drain above wakeup_min_percent.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <glib.h>
+
+#include "config.h"
+#include "logging.h"
+#include "battery.h"
+#include "batterywakeup.h"
+
+#define LOG_DOMAIN "BATTERY_WAKEUP: "
+
+#define WAKEUP_DEFAULT_TABLE	"20,13,11,9,6,5,4,3,2,1"
+#define WAKEUP_MAX_LEVELS	16
+
+/* @brief Suspended drain is folded into the rate once this long or this many percent were seen. */
+#define WAKEUP_RATE_MIN_S	3600
+#define WAKEUP_RATE_MIN_DROP	2
+
+/* @brief Suspends longer than this are taken as RTC changes and ignored. */
+#define WAKEUP_RATE_MAX_S	(7 * 24 * 3600)
+
+/* @brief Weight of a new measurement in the rate average. */
+#define WAKEUP_RATE_WEIGHT	0.25
+
+static struct {
+	int  levels[WAKEUP_MAX_LEVELS];	/* descending */
+	int  count;
+	bool parsed;
+} wakeup_table;
+
+static struct {
+	bool   suspended;
+	time_t suspend_rtc;
+	int    suspend_percent;
+
+	long   acc_s;		/* suspended time and drain not folded into the rate yet */
+	int    acc_drop;
+
+	double rate;		/* percent per hour */
+	bool   valid;
+} battery_wakeup[BATTERY_MAX_DEVICES];
+
+static gint
+wakeup_level_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return *(const int *)b - *(const int *)a;
+}
+
+static void
+battery_wakeup_table_parse(void)
+{
+	const char *table = gChargeConfig.wakeup_percent_table;
+	gchar **levels;
+	int i;
+
+	if (wakeup_table.parsed)
+		return;
+	wakeup_table.parsed = true;
+
+	if (!table || !*table)
+		table = WAKEUP_DEFAULT_TABLE;
+
+	levels = g_strsplit_set(table, ", ", 0);
+	for (i = 0; levels[i] && wakeup_table.count < WAKEUP_MAX_LEVELS; i++)
+	{
+		int level = atoi(levels[i]);
+
+		if (level > 0 && level < 100)
+			wakeup_table.levels[wakeup_table.count++] = level;
+	}
+	g_strfreev(levels);
+
+	g_qsort_with_data(wakeup_table.levels, wakeup_table.count, sizeof(int),
+	                  wakeup_level_compare, NULL);
+}
+
+static time_t
+battery_wakeup_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec;
+}
+
+/**
+ * @brief The device is suspending at percent.
+ */
+void
+battery_wakeup_suspend(int dev, int percent)
+{
+	if (dev < 0 || dev >= BATTERY_MAX_DEVICES)
+		return;
+
+	battery_wakeup[dev].suspended = true;
+	battery_wakeup[dev].suspend_rtc = battery_wakeup_now();
+	battery_wakeup[dev].suspend_percent = percent;
+}
+
+/**
+ * @brief The device resumed at percent: account the drain while suspended.
+ */
+void
+battery_wakeup_resume(int dev, int percent)
+{
+	long slept_s;
+	int drop;
+
+	if (dev < 0 || dev >= BATTERY_MAX_DEVICES || !battery_wakeup[dev].suspended)
+		return;
+
+	battery_wakeup[dev].suspended = false;
+	slept_s = battery_wakeup_now() - battery_wakeup[dev].suspend_rtc;
+	drop = battery_wakeup[dev].suspend_percent - percent;
+
+	if (slept_s <= 0 || slept_s > WAKEUP_RATE_MAX_S || drop < 0)
+	{
+		battery_wakeup[dev].acc_s = 0;
+		battery_wakeup[dev].acc_drop = 0;
+		return;
+	}
+
+	battery_wakeup[dev].acc_s += slept_s;
+	battery_wakeup[dev].acc_drop += drop;
+
+	if (battery_wakeup[dev].acc_s < WAKEUP_RATE_MIN_S &&
+	    battery_wakeup[dev].acc_drop < WAKEUP_RATE_MIN_DROP)
+		return;
+
+	double rate = battery_wakeup[dev].acc_drop * 3600.0 / battery_wakeup[dev].acc_s;
+
+	if (battery_wakeup[dev].valid)
+		battery_wakeup[dev].rate += (rate - battery_wakeup[dev].rate) * WAKEUP_RATE_WEIGHT;
+	else
+		battery_wakeup[dev].rate = rate;
+	battery_wakeup[dev].valid = true;
+
+	battery_wakeup[dev].acc_s = 0;
+	battery_wakeup[dev].acc_drop = 0;
+
+	POWERDLOG(LOG_DEBUG, "device %d: suspended drain %.2f%%/h, average %.2f%%/h",
+	          dev, rate, battery_wakeup[dev].rate);
+}
+
+/**
+ * @brief The device is charging: the level at suspend says nothing about the drain any more.
+ */
+void
+battery_wakeup_charging(int dev)
+{
+	if (dev < 0 || dev >= BATTERY_MAX_DEVICES)
+		return;
+
+	battery_wakeup[dev].suspended = false;
+	battery_wakeup[dev].acc_s = 0;
+	battery_wakeup[dev].acc_drop = 0;
+}
+
+bool
+battery_wakeup_rate(int dev, double *rate)
+{
+	if (dev < 0 || dev >= BATTERY_MAX_DEVICES || !battery_wakeup[dev].valid)
+		return false;
+
+	*rate = battery_wakeup[dev].rate;
+	return true;
+}
+
+/**
+ * @brief Wakeup level to arm the gauge of the device with when suspending at percent, 0 for none.
+ */
+int
+battery_wakeup_threshold(int dev, int percent)
+{
+	int next = 0, chosen = 0;
+	double floor_percent;
+	int i;
+
+	battery_wakeup_table_parse();
+
+	for (i = 0; i < wakeup_table.count; i++)
+	{
+		if (wakeup_table.levels[i] < percent)
+		{
+			next = wakeup_table.levels[i];
+			break;
+		}
+	}
+
+	if (dev < 0 || dev >= BATTERY_MAX_DEVICES || !battery_wakeup[dev].valid || !next)
+		return next;
+
+	floor_percent = gChargeConfig.wakeup_min_percent +
+	                battery_wakeup[dev].rate * gChargeConfig.wakeup_margin_minutes / 60.0;
+
+	for (i = 0; i < wakeup_table.count; i++)
+	{
+		if (wakeup_table.levels[i] < percent && wakeup_table.levels[i] >= floor_percent)
+			chosen = wakeup_table.levels[i];
+	}
+
+	if (!chosen)
+		return next;
+
+	if (chosen != next)
+		POWERDLOG(LOG_INFO, "device %d at %d%%, suspended drain %.2f%%/h: waking at %d%% instead of %d%%",
+		          dev, percent, battery_wakeup[dev].rate, chosen, next);
+
+	return chosen;
+}
@@ -0,0 +1,31 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef _BATTERYWAKEUP_H_
+#define _BATTERYWAKEUP_H_
+
+#include <stdbool.h>
+
+void battery_wakeup_suspend(int dev, int percent);
+void battery_wakeup_resume(int dev, int percent);
+void battery_wakeup_charging(int dev);
+
+int battery_wakeup_threshold(int dev, int percent);
+bool battery_wakeup_rate(int dev, double *rate);
+
+#endif // _BATTERYWAKEUP_H_
@@ -0,0 +1,109 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file chargelimit.c
+ *
+ * @brief Charge current limit policy.
+ *
+ * Derives the charge current setpoint from the charger and the battery state rather than only
+ * switching charging on and off: starting from what the charger can provide, the current is capped
+ * to the C-rate the battery can take given its capacity and age, cut in the cold, derated linearly
+ * over the last CHARGE_LIMIT_DERATE_C degrees below the temperature limit, and reduced near full
+ * where extra current only turns into heat. The charging logic pushes the setpoint to the charger.
+ */
+
+#include <glib.h>
+
+#include "logging.h"
+#include "chargelimit.h"
+
+#define LOG_DOMAIN "CHARGE_LIMIT: "
+
+/* @brief Setpoint used when the charger doesn't report its maximum current. */
+#define CHARGE_LIMIT_DEFAULT_MA		500
+
+/* @brief Never set less than this, nor anything that isn't a multiple of the step. */
+#define CHARGE_LIMIT_MIN_MA		100
+#define CHARGE_LIMIT_STEP_MA		50
+
+/* @brief Maximum C-rate of a healthy battery, and of one aged below CHARGE_LIMIT_AGED_PERCENT. */
+#define CHARGE_LIMIT_C_RATE		1.0
+#define CHARGE_LIMIT_AGED_C_RATE	0.7
+#define CHARGE_LIMIT_AGED_PERCENT	80
+
+/* @brief Below this temperature the current is halved. */
+#define CHARGE_LIMIT_COLD_C		10
+
+/* @brief The current is derated down to CHARGE_LIMIT_HOT_PERCENT over this many degrees below the limit. */
+#define CHARGE_LIMIT_DERATE_C		10
+#define CHARGE_LIMIT_HOT_PERCENT	30
+
+/* @brief Above this level the current is capped to CHARGE_LIMIT_FULL_C_RATE. */
+#define CHARGE_LIMIT_FULL_PERCENT	90
+#define CHARGE_LIMIT_FULL_C_RATE	0.5
+
+/**
+ * @brief Return the charge current setpoint (mA) for the given battery state.
+ *
+ * @param battery              combined battery state
+ * @param charger_max_mA       maximum current the charger can provide, 0 if unknown
+ * @param temperature_limit_C  temperature at which charging stops
+ */
+int
+charge_limit_setpoint(nyx_battery_status_t *battery, int charger_max_mA, int temperature_limit_C)
+{
+	double setpoint = charger_max_mA > 0 ? charger_max_mA : CHARGE_LIMIT_DEFAULT_MA;
+	double full_mAh = battery->capacity_full40;
+
+	if (battery->age > 0)
+		full_mAh = full_mAh * battery->age / 100;
+
+	if (full_mAh > 0)
+	{
+		double c_rate = (battery->age > 0 && battery->age < CHARGE_LIMIT_AGED_PERCENT) ?
+		                CHARGE_LIMIT_AGED_C_RATE : CHARGE_LIMIT_C_RATE;
+
+		setpoint = MIN(setpoint, full_mAh * c_rate);
+
+		if (battery->percentage >= CHARGE_LIMIT_FULL_PERCENT)
+			setpoint = MIN(setpoint, full_mAh * CHARGE_LIMIT_FULL_C_RATE);
+	}
+
+	if (battery->temperature < CHARGE_LIMIT_COLD_C)
+		setpoint /= 2;
+
+	int headroom = temperature_limit_C - battery->temperature;
+	if (headroom < CHARGE_LIMIT_DERATE_C)
+	{
+		int percent = CHARGE_LIMIT_HOT_PERCENT +
+			(100 - CHARGE_LIMIT_HOT_PERCENT) * MAX(headroom, 0) / CHARGE_LIMIT_DERATE_C;
+		setpoint = setpoint * percent / 100;
+	}
+
+	int result = (int)setpoint / CHARGE_LIMIT_STEP_MA * CHARGE_LIMIT_STEP_MA;
+	result = MAX(result, CHARGE_LIMIT_MIN_MA);
+	if (charger_max_mA > 0)
+		result = MIN(result, charger_max_mA);
+
+	POWERDLOG(LOG_DEBUG, "%s: %dmA (charger %dmA, %d%%, %dC, limit %dC, full %.0fmAh)", __func__,
+	          result, charger_max_mA, battery->percentage, battery->temperature,
+	          temperature_limit_C, full_mAh);
+
+	return result;
+}
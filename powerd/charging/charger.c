@@ -41,13 +41,33 @@
 #include "charging_logic.h"
 #include "batterypoll.h"
 #include "config.h"
+#include "subscription.h"
+#include "statuspage.h"
+#include "sysfs.h"
 
 #define LOG_DOMAIN "CHG: "
 
 #include <nyx/nyx_client.h>
 
 
-static nyx_device_handle_t nyxDev = NULL;
+/* @brief Maximum number of nyx charger devices (USB, dock...) tracked. */
+#define CHARGER_MAX_DEVICES	4
+
+#define CHARGER_ID_SIZE		32
+
+/**
+ * @brief One nyx charger device and the last status read from it.
+ */
+struct charger_device {
+	nyx_device_handle_t  handle;
+	char                 id[CHARGER_ID_SIZE];
+	nyx_charger_status_t status;
+};
+
+static struct charger_device charger_devices[CHARGER_MAX_DEVICES];
+static int charger_device_num = 0;
+
+/* @brief Combined status of all chargers, as last broadcast. */
 nyx_charger_status_t currStatus;
 
 const char *
@@ -88,142 +108,438 @@ bool ChargerIsCharging(void)
 	return currStatus.is_charging;
 }
 
-bool
-chargerStatusQuery(LSHandle *sh,
-                   LSMessage *message, void *user_data)
+/**
+ * @brief Fields chargerStatusQuery subscribers can filter on, in the order of charger_subscription_values().
+ */
+static const char *charger_subscription_fields[] = {
+	"DockConnected",
+	"DockPower",
+	"DockSerialNo",
+	"USBConnected",
+	"USBName",
+	"Charging",
+};
+
+/* @brief Fields that only say whether a string changed, thresholds are rejected on them. */
+#define CHARGER_SUBSCRIPTION_CHANGE_ONLY	((1u << 2) | (1u << 4))
+
+static SubscriptionList *charger_subscriptions = NULL;
+
+/* @brief Number of times the dock serial number changed, the DockSerialNo subscription value. */
+static int charger_dock_serial_changes = 0;
+
+static void
+charger_subscription_values(nyx_charger_status_t *status, int *values)
 {
-	nyx_charger_status_t status;
-	if(!nyxDev)
-		return false;
-	nyx_error_t err = nyx_charger_query_charger_status(nyxDev,&status);
+	values[0] = (status->connected & NYX_CHARGER_INDUCTIVE_CONNECTED) != 0;
+	values[1] = (status->powered & NYX_CHARGER_INDUCTIVE_POWERED) != 0;
+	values[2] = charger_dock_serial_changes;
+	values[3] = (status->powered & NYX_CHARGER_USB_POWERED) != 0;
+	values[4] = status->connected;
+	values[5] = status->is_charging;
+}
+
+/**
+ * @brief Fields of a charger status, as reported by charger_status_diff().
+ */
+enum {
+	CHARGER_DIFF_CONNECTED   = 1 << 0,
+	CHARGER_DIFF_POWERED     = 1 << 1,
+	CHARGER_DIFF_CHARGING    = 1 << 2,
+	CHARGER_DIFF_MAX_CURRENT = 1 << 3,
+	CHARGER_DIFF_DOCK_SERIAL = 1 << 4,
+	/* @brief The status of one of several devices changed, which only shows in the "chargers" arrays. */
+	CHARGER_DIFF_DEVICES     = 1 << 5,
+	CHARGER_DIFF_ALL         = (1 << 6) - 1,
+};
+
+/* @brief Fields each cached payload depends on. */
+#define CHARGER_DIFF_USB_DOCK_PAYLOAD	(CHARGER_DIFF_CONNECTED | CHARGER_DIFF_POWERED | \
+		CHARGER_DIFF_CHARGING | CHARGER_DIFF_DOCK_SERIAL | CHARGER_DIFF_DEVICES)
+#define CHARGER_DIFF_CHARGER_PAYLOAD	(CHARGER_DIFF_CONNECTED | CHARGER_DIFF_POWERED | \
+		CHARGER_DIFF_MAX_CURRENT | CHARGER_DIFF_DEVICES)
+#define CHARGER_DIFF_CONNECTED_PAYLOAD	CHARGER_DIFF_CONNECTED
+
+static guint
+charger_status_diff(nyx_charger_status_t *old, nyx_charger_status_t *new)
+{
+	guint diff = 0;
+
+	if(old->connected != new->connected)
+		diff |= CHARGER_DIFF_CONNECTED;
+	if(old->powered != new->powered)
+		diff |= CHARGER_DIFF_POWERED;
+	if(old->is_charging != new->is_charging)
+		diff |= CHARGER_DIFF_CHARGING;
+	if(old->charger_max_current != new->charger_max_current)
+		diff |= CHARGER_DIFF_MAX_CURRENT;
+	if(strncmp(old->dock_serial_number, new->dock_serial_number, sizeof(old->dock_serial_number)))
+		diff |= CHARGER_DIFF_DOCK_SERIAL;
+
+	return diff;
+}
+
+/**
+ * @brief Read the status of charger device i, keeping the previous status on error.
+ *
+ * @retval true if the status of the device changed.
+ */
+static bool
+charger_device_read(int i)
+{
+	nyx_charger_status_t status = {0};
+	nyx_error_t err = nyx_charger_query_charger_status(charger_devices[i].handle,&status);
 
 	if(err != NYX_ERROR_NONE)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_battery_status returned with error : %d",__func__,err);
+		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_charger_status on \"%s\" returned with error : %d",
+				__func__,charger_devices[i].id,err);
+		return false;
 	}
 
+	if(!charger_status_diff(&charger_devices[i].status, &status))
+		return false;
+
+	charger_devices[i].status = status;
+	return true;
+}
+
+/**
+ * @brief Combine the last status of every charger device : the connection, power and charging
+ * bits of all devices, the highest current any of them offers and the first dock serial number.
+ */
+static void
+charger_combine(nyx_charger_status_t *status)
+{
+	int i;
+
+	memset(status,0,sizeof(nyx_charger_status_t));
+
+	for(i = 0; i < charger_device_num; i++)
+	{
+		nyx_charger_status_t *dev = &charger_devices[i].status;
+
+		status->connected |= dev->connected;
+		status->powered |= dev->powered;
+		status->is_charging |= dev->is_charging;
+		status->charger_max_current = MAX(status->charger_max_current, dev->charger_max_current);
+		if(!strlen(status->dock_serial_number) && strlen(dev->dock_serial_number))
+			g_strlcpy(status->dock_serial_number, dev->dock_serial_number,
+					sizeof(status->dock_serial_number));
+	}
+}
+
+/**
+ * @brief Append the "chargers" array describing each device, when there is more than one.
+ */
+static void
+charger_devices_payload(GString *payload)
+{
+	int i;
+
+	if(charger_device_num < 2)
+		return;
+
+	g_string_append(payload, ",\"chargers\":[");
+	for(i = 0; i < charger_device_num; i++)
+	{
+		nyx_charger_status_t *dev = &charger_devices[i].status;
+
+		g_string_append_printf(payload,
+				"%s{\"id\":\"%s\",\"type\":\"%s\",\"name\":\"%s\",\"connected\":%s,"
+				"\"current_mA\":%d,\"Charging\":%s}",
+				i ? "," : "",
+				charger_devices[i].id,
+				ChargerTypeToString(dev->powered),
+				ChargerNameToString(dev->connected),
+				dev->connected ? "true" : "false",
+				dev->charger_max_current,
+				dev->is_charging ? "true" : "false");
+	}
+	g_string_append_c(payload, ']');
+}
+
+/**
+ * @brief Serialized forms of currStatus.
+ *
+ * currStatus is only updated from the nyx callbacks. Each payload is rebuilt when one of the
+ * fields it depends on changed, and queries are answered from here without touching the hardware.
+ */
+static struct {
+	GString *usb_dock;	/* chargerStatusQuery reply, USBDockStatus signal */
+	GString *charger;	/* chargerStatus signal */
+	GString *connected;	/* chargerConnected signal */
+} charger_payloads;
+
+static void
+charger_payloads_update(nyx_charger_status_t *status, guint diff)
+{
+	if(diff & CHARGER_DIFF_USB_DOCK_PAYLOAD)
+	{
+		g_string_printf(charger_payloads.usb_dock, "{\"DockConnected\":%s,\"DockPower\":%s,\"DockSerialNo\":\"%s\","
+				"\"USBConnected\":%s,\"USBName\":\"%s\",\"Charging\":%s",(status->connected & NYX_CHARGER_INDUCTIVE_CONNECTED) ? "true" : "false",
+				(status->powered & NYX_CHARGER_INDUCTIVE_POWERED) ? "true" :"false",(strlen(status->dock_serial_number)) ? status->dock_serial_number : "NULL",
+				(status->powered & NYX_CHARGER_USB_POWERED) ? "true" : "false",ChargerNameToString(status->connected),
+				(status->is_charging) ? "true":"false");
+		charger_devices_payload(charger_payloads.usb_dock);
+		g_string_append_c(charger_payloads.usb_dock, '}');
+	}
+
+	if(diff & CHARGER_DIFF_CHARGER_PAYLOAD)
+	{
+		g_string_printf(charger_payloads.charger, "{\"type\":\"%s\",\"name\":\"%s\",\"connected\":%s,\"current_mA\":%d,\"message_source\":\"powerd\"",
+				ChargerTypeToString(status->powered),
+				ChargerNameToString(status->connected),
+				status->connected ? "true" : "false",
+				status->charger_max_current);
+		charger_devices_payload(charger_payloads.charger);
+		g_string_append_c(charger_payloads.charger, '}');
+	}
+
+	if(diff & CHARGER_DIFF_CONNECTED_PAYLOAD)
+	{
+		g_string_printf(charger_payloads.connected, "{\"connected\":%s}",
+				status->connected ? "true" : "false");
+	}
+}
+
+/**
+ * @brief Mirror the given status into the shared status page read by libpowerd.
+ */
+static void
+charger_status_page_publish(nyx_charger_status_t *status)
+{
+	PowerdChargerStatus charger = {
+		.connected = status->connected != 0,
+		.usb_powered = (status->powered & NYX_CHARGER_USB_POWERED) != 0,
+		.dock_powered = (status->powered & NYX_CHARGER_INDUCTIVE_POWERED) != 0,
+		.charging = status->is_charging,
+		.max_current_mA = status->charger_max_current,
+	};
+
+	g_strlcpy(charger.type, ChargerTypeToString(status->powered), sizeof(charger.type));
+	g_strlcpy(charger.name, ChargerNameToString(status->connected), sizeof(charger.name));
+
+	StatusPagePublishCharger(&charger);
+}
+
+/**
+ * @brief Reply to the chargerStatusQuery subscribers affected by the given status.
+ */
+static void
+charger_subscriptions_notify(nyx_charger_status_t *status)
+{
+	int values[G_N_ELEMENTS(charger_subscription_fields)];
+
+	if(!charger_subscriptions || !SubscriptionListCount(charger_subscriptions))
+		return;
+
+	charger_subscription_values(status, values);
+	SubscriptionListNotify(charger_subscriptions, values, charger_payloads.usb_dock->str);
+}
+
+bool
+chargerStatusQuery(LSHandle *sh,
+                   LSMessage *message, void *user_data)
+{
+	int values[G_N_ELEMENTS(charger_subscription_fields)];
+	if(!charger_device_num)
+		return false;
+
 	LSError lserror;
 	LSErrorInit(&lserror);
 
-	char *payload = g_strdup_printf("{\"DockConnected\":%s,\"DockPower\":%s,\"DockSerialNo\":\"%s\","
-				"\"USBConnected\":%s,\"USBName\":\"%s\",\"Charging\":%s}",(status.connected & NYX_CHARGER_INDUCTIVE_CONNECTED) ? "true" : "false",
-				(status.powered & NYX_CHARGER_INDUCTIVE_POWERED) ? "true" :"false",(strlen(status.dock_serial_number)) ? status.dock_serial_number : "NULL",
-				(status.powered & NYX_CHARGER_USB_POWERED) ? "true" : "false",ChargerNameToString(status.connected),
-				(status.is_charging) ? "true":"false");
+	const char *payload = charger_payloads.usb_dock->str;
+
+	charger_subscription_values(&currStatus, values);
+	if(!SubscriptionListAdd(charger_subscriptions, sh, message, values))
+		return TRUE;
 
 	POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
-	bool retVal = LSMessageReply(sh, message, payload,NULL);
+	bool retVal = LSMessageReply(sh, message, payload, &lserror);
 	if (!retVal)
 	{
 
 		LSErrorPrint(&lserror, stderr);
 		LSErrorFree(&lserror);
 	}
-	g_free(payload);
 	return TRUE;
 }
 
 bool charger_changed = false;
 
-void sendChargerStatus(void)
+static void
+charger_signal_send(const char *uri, const char *payload)
 {
-	nyx_charger_status_t status;
-	if(!nyxDev)
-		return;
-	nyx_error_t err = nyx_charger_query_charger_status(nyxDev,&status);
-	if(err != NYX_ERROR_NONE)
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
+
+	bool retVal = LSSignalSend(GetLunaServiceHandle(), uri, payload, &lserror);
+	if (!retVal)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_charger_status returned with error : %d",__func__,err);
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
 	}
-	POWERDLOG(LOG_DEBUG,"In %s connected : %d:%d, powered : %d:%d",__func__,currStatus.connected,status.connected,currStatus.powered,status.powered);
+}
 
-	if(currStatus.connected != status.connected || currStatus.powered != status.powered)
-	{
-		LSError lserror;
-		LSErrorInit(&lserror);
-		char *payload = g_strdup_printf("{\"DockConnected\":%s,\"DockPower\":%s,\"DockSerialNo\":\"%s\","
-			"\"USBConnected\":%s,\"USBName\":\"%s\",\"Charging\":%s}",(status.connected & NYX_CHARGER_INDUCTIVE_CONNECTED) ? "true" : "false",
-					(status.powered & NYX_CHARGER_INDUCTIVE_POWERED) ? "true" :"false",(strlen(status.dock_serial_number)) ? status.dock_serial_number : "NULL",
-					(status.powered & NYX_CHARGER_USB_POWERED) ? "true" : "false",ChargerNameToString(status.connected),
-					(status.is_charging) ? "true":"false");
-
-		POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
-
-		bool retVal = LSSignalSend(GetLunaServiceHandle(),
-			"luna://com.palm.powerd/com/palm/power/USBDockStatus",
-			payload, &lserror);
-		if (!retVal)
-		{
-			LSErrorPrint(&lserror, stderr);
-			LSErrorFree(&lserror);
-			g_free(payload);
-			return;
-		}
-	    g_free(payload);
-
-		payload = g_strdup_printf("{\"type\":\"%s\",\"name\":\"%s\",\"connected\":%s,\"current_mA\":%d,\"message_source\":\"powerd\"}",
-				ChargerTypeToString(status.powered),
-				ChargerNameToString(status.connected),
-				status.connected ? "true" : "false",
-				status.charger_max_current);
-		POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
-
-		retVal = LSSignalSend(GetLunaServiceHandle(),
-				"luna://com.palm.powerd/com/palm/power/chargerStatus",
-				payload, &lserror);
-		if (!retVal)
-		{
+/**
+ * @brief Recompute the combined charger status, and regenerate and broadcast the payloads
+ * affected by what changed since the last update.
+ *
+ * @param  devices_changed   a device status changed, which may only show in the "chargers" arrays.
+ */
+static void
+charger_status_update(bool devices_changed)
+{
+	nyx_charger_status_t status;
 
-			LSErrorPrint(&lserror, stderr);
-			LSErrorFree(&lserror);
-		}
-		g_free(payload);
+	charger_combine(&status);
+
+	guint diff = charger_status_diff(&currStatus, &status);
+	if(devices_changed && charger_device_num > 1)
+		diff |= CHARGER_DIFF_DEVICES;
+
+	POWERDLOG(LOG_DEBUG,"In %s connected : %d:%d, powered : %d:%d, diff : 0x%x",__func__,
+			currStatus.connected,status.connected,currStatus.powered,status.powered,diff);
+
+	if(!diff)
+		return;
+
+	charger_payloads_update(&status, diff);
+
+	if(diff & (CHARGER_DIFF_CONNECTED | CHARGER_DIFF_POWERED))
+	{
+		charger_signal_send("luna://com.palm.powerd/com/palm/power/USBDockStatus",
+				charger_payloads.usb_dock->str);
+		charger_signal_send("luna://com.palm.powerd/com/palm/power/chargerStatus",
+				charger_payloads.charger->str);
 	}
-	if(currStatus.connected != status.connected)
+	if(diff & CHARGER_DIFF_CONNECTED)
 	{
-	    char *payload = g_strdup_printf("{\"connected\":%s}",
-	    		status.connected ? "true" : "false");
-
-	    LSError lserror;
-	    LSErrorInit(&lserror);
-	    POWERDLOG(LOG_DEBUG,"%s: Sending payload : %s",__func__,payload);
-
-	    bool retVal = LSSignalSend(GetLunaServiceHandle(),
-	            "luna://com.palm.power/com/palm/power/chargerConnected",
-	            payload, &lserror);
-	    g_free(payload);
-
-	    if (!retVal)
-	    {
-	        LSErrorPrint(&lserror, stderr);
-	        LSErrorFree(&lserror);
-	    }
+		charger_signal_send("luna://com.palm.power/com/palm/power/chargerConnected",
+				charger_payloads.connected->str);
 	}
 
+	if(diff & CHARGER_DIFF_DOCK_SERIAL)
+		charger_dock_serial_changes++;
+
+	charger_subscriptions_notify(&status);
+	charger_status_page_publish(&status);
+
 	memcpy(&currStatus,&status,sizeof(nyx_charger_status_t));
 
 	// Iterate through both charging as well as battery state machines. Is this required ??
 //	ChargingLogicUpdate(NYX_NO_NEW_EVENT);
+}
 
-	return;
+/**
+ * @brief Broadcast the charger status if it changed since the last broadcast.
+ *
+ * The status is kept up to date by the nyx callbacks, so the hardware is not queried.
+ */
+void sendChargerStatus(void)
+{
+	if(!charger_device_num)
+		return;
+
+	charger_status_update(false);
 }
 
 void notifyChargerStatus(nyx_device_handle_t handle, nyx_callback_status_t status, void* data)
 {
-	sendChargerStatus();
+	int i = GPOINTER_TO_INT(data);
+
+	if(i < 0 || i >= charger_device_num)
+		return;
+
+	charger_status_update(charger_device_read(i));
 }
 
-void notifyStateChange(nyx_device_handle_t handle, nyx_callback_status_t status, void* data)
+/**
+ * @brief Query the pending charger event of device i.
+ */
+static nyx_charger_event_t
+charger_device_event(int i)
 {
-	nyx_charger_event_t new_event;
+	nyx_charger_event_t new_event = NYX_NO_NEW_EVENT;
 
-	nyx_error_t err = nyx_charger_query_charger_event(nyxDev,&new_event);
+	nyx_error_t err = nyx_charger_query_charger_event(charger_devices[i].handle,&new_event);
 	if(err != NYX_ERROR_NONE)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_event returned with error : %d",__func__,err);
+		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_event on \"%s\" returned with error : %d",
+				__func__,charger_devices[i].id,err);
+		return NYX_NO_NEW_EVENT;
+	}
+
+	return new_event;
+}
+
+/**
+ * @brief Charger event coalescer.
+ *
+ * Plugging a cable in typically raises a burst of CONNECTED, PRESENT and RESTART events. Their bits
+ * are ORed together for [charger] event_window_ms after the first one, and the state machines then
+ * run once for the whole burst. Events which may require a shutdown are never delayed.
+ */
+#define CHARGER_EVENT_URGENT	(NYX_BATTERY_CRITICAL_VOLTAGE | NYX_BATTERY_TEMPERATURE_LIMIT)
+
+static struct {
+	int   pending;
+	guint count;
+	guint timeout;
+} charger_events;
+
+static void
+charger_event_flush(void)
+{
+	nyx_charger_event_t event = charger_events.pending;
+	guint count = charger_events.count;
+
+	if(charger_events.timeout)
+	{
+		g_source_remove(charger_events.timeout);
+		charger_events.timeout = 0;
 	}
+	charger_events.pending = NYX_NO_NEW_EVENT;
+	charger_events.count = 0;
+
+	POWERDLOG(LOG_INFO,"%s: handling event 0x%x merged from %u raw event(s)",__func__,event,count);
+
+	battery_sample_invalidate();
+	handle_charger_event(event);
+}
+
+static gboolean
+charger_event_timeout(gpointer data)
+{
+	charger_events.timeout = 0;
+	charger_event_flush();
+	return FALSE;
+}
+
+static void
+charger_event_queue(nyx_charger_event_t event)
+{
+	charger_events.pending |= event;
+	charger_events.count++;
+
+	if(gChargeConfig.charger_event_window_ms <= 0 || (event & CHARGER_EVENT_URGENT))
+		charger_event_flush();
+	else if(!charger_events.timeout)
+		charger_events.timeout = g_timeout_add(gChargeConfig.charger_event_window_ms,
+				charger_event_timeout, NULL);
+}
+
+void notifyStateChange(nyx_device_handle_t handle, nyx_callback_status_t status, void* data)
+{
+	int i = GPOINTER_TO_INT(data);
+
+	if(i < 0 || i >= charger_device_num)
+		return;
 
-    handle_charger_event(new_event);
+	charger_event_queue(charger_device_event(i));
 }
 
 bool
@@ -234,18 +550,82 @@ chargerStatusQuerySignal(LSHandle *sh,
 	return true;
 }
 
+/**
+ * @brief Maximum current (mA) the connected chargers can provide, 0 if unknown.
+ */
+int
+ChargerMaxCurrent(void)
+{
+	return currStatus.charger_max_current;
+}
+
+/* @brief Charge current limit last written, 0 if none. */
+static int charger_current_limit = 0;
+
+/**
+ * @brief Limit the charge current to max_mA.
+ *
+ * nyx has no charge current control, so the limit is written (in uA, like the power_supply
+ * constant_charge_current_max attribute) to the file set by [charger] current_limit_path.
+ *
+ * @retval false if there is no way to set the limit or writing it failed.
+ */
+bool
+chargerSetCurrentLimit(int max_mA)
+{
+	char value[16];
+
+	if(!gChargeConfig.charger_current_limit_path || !*gChargeConfig.charger_current_limit_path)
+		return false;
+
+	if(max_mA == charger_current_limit)
+		return true;
+
+	snprintf(value, sizeof(value), "%d", max_mA * 1000);
+	if(SysfsWriteString(gChargeConfig.charger_current_limit_path, value) < 0)
+	{
+		POWERDLOG(LOG_ERR,"%s: could not write %s to %s",__func__,value,
+				gChargeConfig.charger_current_limit_path);
+		return false;
+	}
+
+	POWERDLOG(LOG_INFO,"Charge current limit %dmA -> %dmA",charger_current_limit,max_mA);
+	charger_current_limit = max_mA;
+	return true;
+}
+
+/**
+ * @brief Enable charging on every charger device.
+ *
+ * @param max_charging_current  charge current limit (mA) to apply, 0 for whatever the chargers
+ *                              provide; set to the effective limit on return.
+ *
+ * @retval false if no charger could be enabled.
+ */
 bool
 chargerEnableCharging(int *max_charging_current)
 {
 	nyx_charger_status_t status;
-	nyx_error_t err = nyx_charger_enable_charging(nyxDev,&status);
-	if(err != NYX_ERROR_NONE)
+	bool enabled = false;
+	int i;
+
+	for(i = 0; i < charger_device_num; i++)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_enable_charging returned with error : %d",__func__,err);
-		return false;
+		nyx_error_t err = nyx_charger_enable_charging(charger_devices[i].handle,&status);
+		if(err != NYX_ERROR_NONE)
+		{
+			POWERDLOG(LOG_ERR,"%s: nyx_charger_enable_charging on \"%s\" returned with error : %d",
+					__func__,charger_devices[i].id,err);
+			continue;
+		}
+		enabled = true;
 	}
 
-	*max_charging_current = currStatus.charger_max_current;
+	if(!enabled)
+		return false;
+
+	if(*max_charging_current <= 0 || !chargerSetCurrentLimit(*max_charging_current))
+		*max_charging_current = currStatus.charger_max_current;
 	battery_set_wakeup_percentage(true,false);
 	return true;
 }
@@ -254,26 +634,36 @@ bool
 chargerDisableCharging(void)
 {
 	nyx_charger_status_t status;
-	nyx_error_t err = nyx_charger_disable_charging(nyxDev,&status);
-	if(err != NYX_ERROR_NONE)
+	int i;
+
+	for(i = 0; i < charger_device_num; i++)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_disable_charging returned with error : %d",__func__,err);
+		nyx_error_t err = nyx_charger_disable_charging(charger_devices[i].handle,&status);
+		if(err != NYX_ERROR_NONE)
+		{
+			POWERDLOG(LOG_ERR,"%s: nyx_charger_disable_charging on \"%s\" returned with error : %d",
+					__func__,charger_devices[i].id,err);
+		}
 	}
 	battery_set_wakeup_percentage(false,false);
 
 	return true;
 }
 
+/**
+ * @brief Synchronously handle the pending charger events, including the ones still being coalesced.
+ */
 void getNewEvent(void)
 {
-	nyx_charger_event_t new_event;
-	nyx_error_t err = nyx_charger_query_charger_event(nyxDev,&new_event);
-	if(err != NYX_ERROR_NONE)
+	int i;
+
+	for(i = 0; i < charger_device_num; i++)
 	{
-		POWERDLOG(LOG_ERR,"%s: nyx_charger_query_event returned with error : %d",__func__,err);
+		charger_events.pending |= charger_device_event(i);
+		charger_events.count++;
 	}
 
-	handle_charger_event(new_event);
+	charger_event_flush();
 }
 
 /**
@@ -282,7 +672,8 @@ void getNewEvent(void)
 
 int ChargerInit(void)
 {
-	int ret = 0;
+	int ret = 0, i;
+	bool changed = false;
 	nyx_init();
 
 	nyx_error_t error = NYX_ERROR_NONE;
@@ -299,17 +690,40 @@ int ChargerInit(void)
 			&id)) == NYX_ERROR_NONE && NULL != id)
 		{
 			g_debug("Powerd: Charger device id \"%s\" found",id);
-			error = nyx_device_open(NYX_DEVICE_CHARGER, id, &nyxDev);
+			if(charger_device_num == CHARGER_MAX_DEVICES)
+			{
+				POWERDLOG(LOG_WARNING,"Ignoring charger device \"%s\", already using %d",
+						id,CHARGER_MAX_DEVICES);
+				continue;
+			}
+
+			struct charger_device *dev = &charger_devices[charger_device_num];
+
+			error = nyx_device_open(NYX_DEVICE_CHARGER, id, &dev->handle);
 			if(error != NYX_ERROR_NONE)
 			{
-				goto error;
+				POWERDLOG(LOG_ERR,"Could not open charger device \"%s\" : %d",id,error);
+				continue;
 			}
-			break;
+			g_strlcpy(dev->id, id, sizeof(dev->id));
+			charger_device_num++;
 		}
 	}
 
+	if(charger_device_num == 0)
+		goto error;
+
 	memset(&currStatus,0,sizeof(nyx_charger_status_t));
 
+	charger_payloads.usb_dock = g_string_sized_new(256);
+	charger_payloads.charger = g_string_sized_new(128);
+	charger_payloads.connected = g_string_sized_new(32);
+	charger_payloads_update(&currStatus, CHARGER_DIFF_ALL);
+
+	charger_subscriptions = SubscriptionListNew("chargerStatusQuery",
+			charger_subscription_fields, G_N_ELEMENTS(charger_subscription_fields),
+			CHARGER_SUBSCRIPTION_CHANGE_ONLY);
+
 	LSError lserror;
 	LSErrorInit(&lserror);
 	bool retVal;
@@ -322,10 +736,20 @@ int ChargerInit(void)
 	if (!retVal)
 		goto lserror;
 
-	nyx_charger_register_charger_status_callback(nyxDev,notifyChargerStatus,NULL);
+	for(i = 0; i < charger_device_num; i++)
+	{
+		nyx_charger_register_charger_status_callback(charger_devices[i].handle,
+				notifyChargerStatus,GINT_TO_POINTER(i));
+
+		if (!gChargeConfig.skip_battery_check && !gChargeConfig.disable_charging)
+			nyx_charger_register_state_change_callback(charger_devices[i].handle,
+					notifyStateChange,GINT_TO_POINTER(i));
+	}
 
-    if (!gChargeConfig.skip_battery_check && !gChargeConfig.disable_charging)
-    	nyx_charger_register_state_change_callback(nyxDev,notifyStateChange,NULL);
+	/* Initial state, the callbacks keep it up to date from now on. */
+	for(i = 0; i < charger_device_num; i++)
+		changed |= charger_device_read(i);
+	charger_status_update(changed);
 
 out:
 	if(iteraror)
@@ -32,6 +32,8 @@ ChargerType ChargerNameParse(const char *type);
 const char * ChargerNameToString(ChargerName type);
 
 bool chargerEnableCharging(int *max_charging_current);
+bool chargerSetCurrentLimit(int max_mA);
+int ChargerMaxCurrent(void);
 bool chargerDisableCharging(void);
 bool ChargerIsConnected(void);
 bool ChargerIsCharging(void);
@@ -27,6 +27,11 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/reboot.h>
 
 #include "battery.h"
 #include "batterypoll.h"
@@ -36,20 +41,22 @@
 #include "logging.h"
 #include "suspend.h"
 #include "charging_logic.h"
+#include "batterythermal.h"
+#include "chargelimit.h"
+#include "overcharge.h"
 #include "lunaservice_utils.h"
 #include "main.h"
+#include "statemachine.h"
 #include "sysfs.h"
 
 #define LOG_DOMAIN "CHG_LOGIC: "
 
-#define OVERCHARGE_RETRIES	3
-
 #define BATTERY_MAX_TEMPERATURE_C	60
 
 nyx_battery_ctia_t battery_ctia_params;
 
 
-static char *debug_state_description[kChargeStateLast+1] =
+static const char *debug_state_description[kChargeStateLast+1] =
 {
     "idle",
     "charging",
@@ -61,26 +68,57 @@ static char *debug_state_description[kChargeStateLast+1] =
 };
 
 
-static ChargeState StateIdle(nyx_charger_event_t event);
+static ChargeState StateIdle(gpointer data);
+
+static ChargeState StateCharging(gpointer data);
 
-static ChargeState StateCharging(nyx_charger_event_t event);
+static ChargeState StateChargeComplete(gpointer data);
+static ChargeState StateFault(gpointer data);
 
-static ChargeState StateChargeComplete(nyx_charger_event_t event);
-static ChargeState StateFault(nyx_charger_event_t event);
+static ChargeState StateShutdown(gpointer data);
+static ChargeState StateShutdownWait(gpointer data);
 
-static ChargeState StateShutdown(nyx_charger_event_t event);
-static ChargeState StateShutdownWait(nyx_charger_event_t event);
 
+static const StateFunc kStateFunctions[kChargeStateLast] = {
+    [kChargeStateIdle]           = StateIdle,
+//    [kChargeStateCritical]       = StateCritical,
+//    [kChargeStateCriticalWait]   = StateCriticalWait,
+    [kChargeStateCharging]       = StateCharging,
+    [kChargeStateFault]          = StateFault,
+    [kChargeStateChargeComplete] = StateChargeComplete,
+    [kChargeStateShutdown]       = StateShutdown,
+    [kChargeStateShutdownWait]   = StateShutdownWait,
+};
+
+/**
+ * @brief Edges of the charge state machine. Any state may also be forced into "shutdown" by
+ * _JumpToShutdownState().
+ */
+static const StateTransition kStateTransitions[] = {
+    { kChargeStateIdle,           kChargeStateCharging },
+    { kChargeStateCharging,       kChargeStateIdle },
+    { kChargeStateCharging,       kChargeStateChargeComplete },
+    { kChargeStateCharging,       kChargeStateFault },
+    { kChargeStateChargeComplete, kChargeStateIdle },
+    { kChargeStateFault,          kChargeStateIdle },
+    { kChargeStateShutdown,       kChargeStateShutdownWait },
+
+    { kChargeStateIdle,           kChargeStateShutdown },
+    { kChargeStateCharging,       kChargeStateShutdown },
+    { kChargeStateChargeComplete, kChargeStateShutdown },
+    { kChargeStateFault,          kChargeStateShutdown },
+};
+
+static void ChargeStateTransitionLog(int state, gpointer data);
 
-static struct ChargeStateNode kStateMachine[kChargeStateLast] = {
-    { kChargeStateIdle,                StateIdle },
-//    { kChargeStateCritical,            StateCritical },
-//    { kChargeStateCriticalWait,        StateCriticalWait },
-    { kChargeStateCharging,            StateCharging },
-    { kChargeStateFault,               StateFault },
-    { kChargeStateChargeComplete,      StateChargeComplete },
-    { kChargeStateShutdown,            StateShutdown },
-    { kChargeStateShutdownWait,        StateShutdownWait },
+static StateMachine kStateMachine = {
+    .name = "charge",
+    .state_names = debug_state_description,
+    .functions = kStateFunctions,
+    .num_states = kChargeStateLast,
+    .transitions = kStateTransitions,
+    .num_transitions = G_N_ELEMENTS(kStateTransitions),
+    .step = ChargeStateTransitionLog,
 };
 
 #define VOLTAGE_WINDOW (5)
@@ -116,10 +154,15 @@ struct {
 
     time_t taper_time_start[kTaperEnd];
 
+    ChargePhase     phase;
+
+    bool            thermal_hold;
+
     ChargeState     current_state;
-    struct ChargeStateNode state_node;
 
     const char *shutdown_reason;
+    bool        shutdown_emergency;
+    struct timespec shutdown_trigger;
 
     int             chargerTimeoutSource;
 } gCurrentChargeState;
@@ -129,6 +172,10 @@ struct {
  * @{
  */
 static void ChargeStateReset(void);
+static void ChargePhaseStart(void);
+static void ChargePhaseStop(const char *reason);
+static void FastHaltRecordReport(void);
+static int ChargeThermalLimit(void);
 
 /**
  * @brief Turn Charging off by calling the device specific charging disable function.
@@ -144,6 +191,7 @@ void TurnChargingOff(const char *reason)
     {
         POWERDLOG(LOG_INFO, "Turning charging off because of %s", reason);
 
+        ChargePhaseStop(reason);
         ChargeStateReset();
         chargerDisableCharging();
 
@@ -152,6 +200,45 @@ void TurnChargingOff(const char *reason)
 }
 
 
+/* @brief Last setpoint of the charge current limit policy, in mA. */
+static int charge_current_setpoint = 0;
+
+static int
+ChargeCurrentSetpoint(void)
+{
+    nyx_battery_status_t state;
+
+    battery_read(&state);
+    return charge_limit_setpoint(&state, ChargerMaxCurrent(), ChargeThermalLimit());
+}
+
+/**
+ * @brief Follow the charge current limit policy while charging, with every battery poll.
+ *
+ * The new setpoint is only pushed to the charger when it moved by at least
+ * [charger] current_limit_hysteresis_ma from the last one.
+ */
+void
+ChargingLogicCurrentLimitUpdate(void)
+{
+    int setpoint;
+
+    if (gCurrentChargeState.charging_enabled != CHARGING_ENABLED ||
+        gCurrentChargeState.thermal_hold)
+        return;
+
+    setpoint = ChargeCurrentSetpoint();
+    if (abs(setpoint - charge_current_setpoint) < gChargeConfig.charger_current_limit_hysteresis_ma)
+        return;
+
+    POWERDLOG(LOG_INFO, "Charge current setpoint %dmA -> %dmA",
+              charge_current_setpoint, setpoint);
+
+    charge_current_setpoint = setpoint;
+    if (chargerSetCurrentLimit(setpoint))
+        gCurrentChargeState.max_charging_mA = setpoint;
+}
+
 /**
  * @brief Turn Charging on if its not already on, by calling the device specific charging enable function.
  *
@@ -160,6 +247,14 @@ void TurnChargingOff(const char *reason)
 bool
 TurnChargingON(void)
 {
+    if (gCurrentChargeState.charging_enabled != CHARGING_ENABLED)
+    {
+        ChargePhaseStart();
+
+        charge_current_setpoint = ChargeCurrentSetpoint();
+        gCurrentChargeState.max_charging_mA = charge_current_setpoint;
+    }
+
     gCurrentChargeState.charging_enabled = CHARGING_ENABLED;
 	return chargerEnableCharging(&gCurrentChargeState.max_charging_mA);
 }
@@ -179,57 +274,219 @@ _debug_battery_taper(nyx_battery_status_t * state, int taper_type, int min_curre
             taper_state);
 }
 
-bool BatteryOverchargeFault(nyx_battery_status_t *state)
+/**
+ * @brief Charge phase tracking.
+ *
+ * A charge cycle starts in the constant current phase. The taper phase starts once the average
+ * current falls below CHARGE_TAPER_CURRENT_PERCENT of the highest average current of the cycle
+ * while the voltage stays at the highest voltage of the cycle, which is the charger holding the
+ * termination voltage. The current falling while the voltage drops as well is the charger folding
+ * back (typically on temperature), recorded in taper_time_start[kTaperMediumTemperature] without
+ * ending the constant current phase. Both need a majority of the last samples to agree.
+ */
+
+/* @brief The current is tapering below this percentage of the peak current of the cycle. */
+#define CHARGE_TAPER_CURRENT_PERCENT	85
+
+/* @brief The voltage is held when within this many mV of the highest voltage of the cycle. */
+#define CHARGE_TAPER_VOLTAGE_BAND_MV	25
+
+static const char *charge_phase_names[] = {
+    [kChargePhaseNone]            = "none",
+    [kChargePhaseConstantCurrent] = "cc",
+    [kChargePhaseTaper]           = "taper",
+    [kChargePhaseDone]            = "done",
+};
+
+static struct {
+    int     current[CURRENT_WINDOW];
+    int     voltage[VOLTAGE_WINDOW];
+    guint   count;
+    int     peak_current;
+    int     peak_voltage;
+
+    /* durations of the last finished cycle */
+    int     last_cc_s;
+    int     last_taper_s;
+} charge_phase;
+
+static time_t
+charge_phase_now(void)
 {
-    static int overcharge_diag_state = 0;
-    static int overcharge_count = 0;
-    bool overcharge;
-    double raw_mAh;
-    double full_mAh;
-    double age;
-    double limit;
+    struct timespec now;
 
-    raw_mAh = state->capacity_raw;
-    full_mAh = state->capacity_full40;
-    age = state->age;
+    ClockGetTime(&now);
+    return now.tv_sec;
+}
 
-    // Diagnostic to detect getting close to overcharge
-    int new_diag_state = 0;
-    limit = 0;
-
-    if (raw_mAh >= (limit = (1.2 * (full_mAh * age / 100)))) {
-      new_diag_state = 120;
-    } else if (raw_mAh >= (limit = (1.1 * (full_mAh * age / 100)))) {
-      new_diag_state = 110;
-    } else if (raw_mAh >= (limit = (1.0 * (full_mAh * age / 100)))) {
-      new_diag_state = 100;
-    } else {
-      new_diag_state = 0;
+/**
+ * @brief Seconds spent in the constant current and taper phases by the cycle in progress.
+ */
+static void
+charge_phase_elapsed(time_t now, int *cc_s, int *taper_s)
+{
+    time_t taper_start = gCurrentChargeState.taper_time_start[kTaperChargeComplete];
+
+    if (taper_start < 0)
+    {
+        *cc_s = now - gCurrentChargeState.start_charging.tv_sec;
+        *taper_s = 0;
+    }
+    else
+    {
+        *cc_s = taper_start - gCurrentChargeState.start_charging.tv_sec;
+        *taper_s = now - taper_start;
     }
+}
 
-    if (new_diag_state != overcharge_diag_state) {
-        POWERDLOG(LOG_INFO, "charge capacity diag: "
-                "raw = (%g) > %d%% of (full_mAh [%g] * age [%g] / 100) = (%g))",
-                raw_mAh, new_diag_state, full_mAh, age, limit);
-        overcharge_diag_state = new_diag_state;
-        _debug_battery_taper(state, new_diag_state, 0, 0, "overcharge-debug");
+static void
+ChargePhaseStart(void)
+{
+    int i;
+
+    ClockGetTime(&gCurrentChargeState.start_charging);
+    for (i = 0; i < kTaperEnd; i++)
+        gCurrentChargeState.taper_time_start[i] = -1;
+
+    charge_phase.count = 0;
+    charge_phase.peak_current = 0;
+    charge_phase.peak_voltage = 0;
+
+    gCurrentChargeState.phase = kChargePhaseConstantCurrent;
+    POWERDLOG(LOG_INFO, "Charge cycle started, constant current phase");
+}
+
+static void
+ChargePhaseStop(const char *reason)
+{
+    if (gCurrentChargeState.phase != kChargePhaseConstantCurrent &&
+        gCurrentChargeState.phase != kChargePhaseTaper)
+        return;
+
+    gCurrentChargeState.stop_charging_sec = charge_phase_now();
+    charge_phase_elapsed(gCurrentChargeState.stop_charging_sec,
+                         &charge_phase.last_cc_s, &charge_phase.last_taper_s);
+    gCurrentChargeState.phase = kChargePhaseDone;
+
+    POWERDLOG(LOG_INFO, "Charge cycle stopped (%s): constant current %ds, taper %ds, "
+              "peak %dmA, foldback %s",
+              reason, charge_phase.last_cc_s, charge_phase.last_taper_s,
+              charge_phase.peak_current,
+              gCurrentChargeState.taper_time_start[kTaperMediumTemperature] < 0 ? "no" : "yes");
+}
+
+/**
+ * @brief Feed a fresh battery sample to the charge phase detection.
+ */
+void
+ChargePhaseUpdate(nyx_battery_status_t *state)
+{
+    int current_limit, voltage_limit;
+    int low_current = 0, held_voltage = 0;
+    int i;
+
+    if (gCurrentChargeState.phase != kChargePhaseConstantCurrent &&
+        gCurrentChargeState.phase != kChargePhaseTaper)
+        return;
+
+    /* The system draws more than the charger provides, nothing to learn about the charger. */
+    if (state->avg_current <= 0)
+        return;
+
+    charge_phase.current[charge_phase.count % CURRENT_WINDOW] = state->avg_current;
+    charge_phase.voltage[charge_phase.count % VOLTAGE_WINDOW] = state->voltage;
+    charge_phase.count++;
+
+    charge_phase.peak_current = MAX(charge_phase.peak_current, state->avg_current);
+    charge_phase.peak_voltage = MAX(charge_phase.peak_voltage, state->voltage);
+
+    if (gCurrentChargeState.phase == kChargePhaseTaper || charge_phase.count < CURRENT_WINDOW)
+        return;
+
+    current_limit = charge_phase.peak_current * CHARGE_TAPER_CURRENT_PERCENT / 100;
+    voltage_limit = charge_phase.peak_voltage - CHARGE_TAPER_VOLTAGE_BAND_MV;
+
+    /* Still ramping up, or a load spike on the system side. */
+    if (state->avg_current >= current_limit)
+        return;
+
+    for (i = 0; i < CURRENT_WINDOW; i++)
+        low_current += charge_phase.current[i] < current_limit;
+    for (i = 0; i < VOLTAGE_WINDOW; i++)
+        held_voltage += charge_phase.voltage[i] >= voltage_limit;
+
+    if (low_current < CURRENT_WINDOW_MAJORITY)
+        return;
+
+    if (held_voltage >= VOLTAGE_WINDOW_MAJORITY)
+    {
+        gCurrentChargeState.taper_time_start[kTaperChargeComplete] = charge_phase_now();
+        gCurrentChargeState.phase = kChargePhaseTaper;
+        _debug_battery_taper(state, kTaperChargeComplete, current_limit, voltage_limit, "taper");
+    }
+    else if (gCurrentChargeState.taper_time_start[kTaperMediumTemperature] < 0)
+    {
+        gCurrentChargeState.taper_time_start[kTaperMediumTemperature] = charge_phase_now();
+        _debug_battery_taper(state, kTaperMediumTemperature, current_limit, voltage_limit,
+                             "foldback");
     }
+}
 
-    limit = 1.2 * (full_mAh * age / 100);
-    overcharge = (raw_mAh > limit);
+ChargePhase
+ChargePhaseGet(void)
+{
+    return gCurrentChargeState.phase;
+}
 
-    if (overcharge) {
-        overcharge_count++;
+const char *
+ChargePhaseName(ChargePhase phase)
+{
+    return charge_phase_names[phase];
+}
 
-        POWERDLOG(LOG_INFO, "%s seen %dx: "
-                "raw = (%g) > 1.2 * (full_mAh [%g] * age [%g] / 100) = (%g)",
-                __FUNCTION__, overcharge_count, raw_mAh, full_mAh, age, limit);
+/**
+ * @brief Return the seconds spent in the constant current and taper phases by the cycle in
+ * progress, or by the last cycle once charging stopped.
+ */
+void
+ChargePhaseDurations(int *cc_s, int *taper_s)
+{
+    switch (gCurrentChargeState.phase)
+    {
+    case kChargePhaseConstantCurrent:
+    case kChargePhaseTaper:
+        charge_phase_elapsed(charge_phase_now(), cc_s, taper_s);
+        break;
+    case kChargePhaseDone:
+        *cc_s = charge_phase.last_cc_s;
+        *taper_s = charge_phase.last_taper_s;
+        break;
+    default:
+        *cc_s = 0;
+        *taper_s = 0;
+        break;
     }
-    else {
-        overcharge_count = 0;
+}
+
+static OverchargeDetector overcharge_detector;
+
+bool BatteryOverchargeFault(nyx_battery_status_t *state)
+{
+    static int overcharge_diag_state = 0;
+    bool fault;
+
+    int new_diag_state = overcharge_detector_update(&overcharge_detector, state, &fault);
+
+    // Diagnostic to detect getting close to overcharge
+    if (new_diag_state != overcharge_diag_state) {
+        POWERDLOG(LOG_INFO, "charge capacity diag: "
+                "raw = (%g) > %d%% of (full_mAh [%g] * age [%g] / 100)",
+                state->capacity_raw, new_diag_state, state->capacity_full40, state->age);
+        overcharge_diag_state = new_diag_state;
+        _debug_battery_taper(state, new_diag_state, 0, 0, "overcharge-debug");
     }
 
-    return overcharge && (overcharge_count > OVERCHARGE_RETRIES);
+    return fault;
 }
 
 /** State functions */
@@ -246,38 +503,55 @@ ChargeStateReset(void)
     for (i = 0; i < kTaperEnd; i++) {
         gCurrentChargeState.taper_time_start[i] = -1;
     }
+
+    /* A cycle still in progress here was not stopped by TurnChargingOff(), drop it. */
+    if (gCurrentChargeState.phase != kChargePhaseDone)
+        gCurrentChargeState.phase = kChargePhaseNone;
 }
 
 static int
 ChargeStateInit(void)
 {
+    static bool registered = false;
+
+    if (!registered)
+    {
+        StateMachineRegister(&kStateMachine);
+        registered = true;
+    }
+
     gCurrentChargeState.current_state = kChargeStateIdle;
-    gCurrentChargeState.state_node = kStateMachine[kChargeStateIdle];
 
     ChargeStateReset();
     battery_get_ctia_params();
 
+    FastHaltRecordReport();
+
     return 0;
 }
 
 static void
-ChargeStateTransitionLog(nyx_battery_status_t *state)
+ChargeStateTransitionLog(int state, gpointer data)
 {
     static ChargeState last_state = kChargeStateLast;
     static int last_max_charging_mA = 0;
 
-    if (last_state != gCurrentChargeState.current_state ||
+    if (last_state != state ||
         last_max_charging_mA != gCurrentChargeState.max_charging_mA)
     {
-        last_state = gCurrentChargeState.current_state;
+        nyx_battery_status_t battery = {0};
+
+        battery_read(&battery);
+
+        last_state = state;
         last_max_charging_mA = gCurrentChargeState.max_charging_mA;
 
         POWERDLOG(LOG_INFO,
             "%s in %s (P: %d%%, T: %d C, C: %d mA, V: %d mV, AUTH %s)",
             __FUNCTION__,
-            debug_state_description[gCurrentChargeState.current_state],
-            state->percentage, state->temperature,
-            state->current, state->voltage,
+            debug_state_description[state],
+            battery.percentage, battery.temperature,
+            battery.current, battery.voltage,
             BatteryIsAuthentic() ? "true": "false");
       }
 }
@@ -285,50 +559,33 @@ ChargeStateTransitionLog(nyx_battery_status_t *state)
 /**
  * @brief Iterate through the charging state machine
  *
+ * Drive the state machine until a state function returns the pseudo-state kChargeStateLast.
+ * Subsequent calls to ChargeStateIterate() will call the current state function
+ * to potentially change state.
  */
 
 static void
 ChargeStateIterate(nyx_charger_event_t event)
 {
-    ChargeState next_state;
-    nyx_battery_status_t state;
-
-    battery_read(&state);
-    /*
-        Drive the state machine until next_state goes to the pseudo-state kChargeStateLast.
-        Subsequent calls to ChargeStateIterate() will call the current state function
-        to potentially change state.
-    */
-
-    do {
-        next_state = gCurrentChargeState.state_node.function(event);
-
-        ChargeStateTransitionLog(&state);
-
-        if (kChargeStateLast != next_state)
-        {
-            gCurrentChargeState.current_state = next_state;
-            gCurrentChargeState.state_node = kStateMachine[next_state];
-        }
-    } while (kChargeStateLast != next_state);
+    StateMachineRun(&kStateMachine, &gCurrentChargeState.current_state, GINT_TO_POINTER(event));
 }
 
 /**
 * @brief Jump charging logic to the shutdown state.
 *
 * @param  reason
+* @param  emergency  thermal or critical voltage shutdown, which may skip the clean shutdown
 */
 static void
-_JumpToShutdownState(const char *reason)
+_JumpToShutdownState(const char *reason, bool emergency)
 {
     if (gCurrentChargeState.current_state != kChargeStateShutdown &&
         gCurrentChargeState.current_state != kChargeStateShutdownWait) {
 
-        ChargeState next_state = kChargeStateShutdown;
-
         gCurrentChargeState.shutdown_reason = reason;
-        gCurrentChargeState.current_state = next_state;
-        gCurrentChargeState.state_node = kStateMachine[next_state];
+        gCurrentChargeState.shutdown_emergency = emergency;
+        ClockGetTime(&gCurrentChargeState.shutdown_trigger);
+        StateMachineJump(&kStateMachine, &gCurrentChargeState.current_state, kChargeStateShutdown);
     }
 }
 
@@ -372,7 +629,7 @@ CheckCriticalLevels(nyx_battery_status_t *state)
 
     if (!BatteryIsPresent())
     {
-        _JumpToShutdownState("battery removed.");
+        _JumpToShutdownState("battery removed.", false);
         return true;
     }
 
@@ -389,8 +646,9 @@ CheckCriticalLevels(nyx_battery_status_t *state)
  */
 
 static ChargeState
-StateIdle(nyx_charger_event_t event)
+StateIdle(gpointer data)
 {
+    nyx_charger_event_t event = GPOINTER_TO_INT(data);
     TurnChargingOff("charge state is idle");
 
     if (!BatteryIsAuthentic() &&  !gChargeConfig.fake_battery)
@@ -455,11 +713,83 @@ StateCriticalWait(battery_status_t *state)
 }
 #endif
 
+/**
+ * @brief Fast halt, for thermal and critical voltage shutdowns with --fasthalt.
+ *
+ * Skips the machineOff handshake with the applications and services: the filesystems are synced
+ * and the device is powered off right away. The time from the trigger to the power off is logged,
+ * and kept in FASTHALT_RECORD so that it is reported again on the next boot.
+ */
+
+#define FASTHALT_RECORD	"last_fasthalt"
+
+static long
+ShutdownLatencyMs(void)
+{
+    struct timespec now, elapsed;
+
+    ClockGetTime(&now);
+    ClockDiff(&elapsed, &now, &gCurrentChargeState.shutdown_trigger);
+    return ClockGetMs(&elapsed);
+}
+
+static void
+FastHaltRecordSave(const char *reason, long latency_ms)
+{
+    char *path = g_build_filename(gChargeConfig.preference_dir, FASTHALT_RECORD, NULL);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0)
+    {
+        dprintf(fd, "%s, powered off %ldms after the trigger\n", reason, latency_ms);
+        fsync(fd);
+        close(fd);
+    }
+
+    g_free(path);
+}
+
+static void
+FastHaltRecordReport(void)
+{
+    char *path = g_build_filename(gChargeConfig.preference_dir, FASTHALT_RECORD, NULL);
+    char *record = NULL;
+
+    if (g_file_get_contents(path, &record, NULL, NULL))
+    {
+        POWERDLOG(LOG_WARNING, "Previous boot ended in a fast halt: %s", g_strchomp(record));
+        unlink(path);
+        g_free(record);
+    }
+
+    g_free(path);
+}
+
+static void
+FastHalt(const char *reason)
+{
+    long latency_ms;
+
+    sync();
+
+    latency_ms = ShutdownLatencyMs();
+    POWERDLOG(LOG_CRIT, "Fast halt (%s): powering off %ldms after the trigger", reason, latency_ms);
+    write_console("powerd: fast halt (%s), powering off %ldms after the trigger\n",
+                  (char *)reason, latency_ms);
+
+    FastHaltRecordSave(reason, latency_ms);
+
+    reboot(RB_POWER_OFF);
+
+    /* Still running, leave it to the regular shutdown. */
+    POWERDLOG(LOG_CRIT, "Fast halt failed: %s", strerror(errno));
+}
+
 /**
  * @brief This is the state in which the device begins shutting down.
  */
 static ChargeState
-StateShutdown(nyx_charger_event_t event)
+StateShutdown(gpointer data)
 {
 	char default_reason[] = "Critical battery levels";
 	nyx_battery_status_t state;
@@ -476,7 +806,12 @@ StateShutdown(nyx_charger_event_t event)
     if(!gCurrentChargeState.shutdown_reason && !strlen(gCurrentChargeState.shutdown_reason))
     	gCurrentChargeState.shutdown_reason = default_reason;
 
+    if (gChargeConfig.fasthalt && gCurrentChargeState.shutdown_emergency)
+        FastHalt(gCurrentChargeState.shutdown_reason);
+
     MachineShutdown(gCurrentChargeState.shutdown_reason);
+    POWERDLOG(LOG_CRIT, "Shutdown (%s) requested %ldms after the trigger",
+              gCurrentChargeState.shutdown_reason, ShutdownLatencyMs());
 
     g_free(report);
 
@@ -487,7 +822,7 @@ StateShutdown(nyx_charger_event_t event)
  * @brief The device stays in this state until it fully shuts down.
  */
 static ChargeState
-StateShutdownWait(nyx_charger_event_t event)
+StateShutdownWait(gpointer data)
 {
     // The state machine will stick in this state until we actually shut down
     return kChargeStateLast;
@@ -504,8 +839,9 @@ StateShutdownWait(nyx_charger_event_t event)
  */
 
 static ChargeState
-StateCharging(nyx_charger_event_t event)
+StateCharging(gpointer data)
 {
+    nyx_charger_event_t event = GPOINTER_TO_INT(data);
 	nyx_battery_status_t state;
 
     if (!ChargerIsConnected() || !BatteryIsAuthentic())
@@ -524,6 +860,12 @@ StateCharging(nyx_charger_event_t event)
         return kChargeStateFault;
     }
 
+    /* Charging stays off until ChargingLogicThermalCheck() sees the battery cooling down. */
+    if (gCurrentChargeState.thermal_hold)
+    {
+        return kChargeStateLast;
+    }
+
     if (!TurnChargingON())
     {
         return kChargeStateIdle;
@@ -533,8 +875,9 @@ StateCharging(nyx_charger_event_t event)
 }
 
 static ChargeState
-StateChargeComplete(nyx_charger_event_t event)
+StateChargeComplete(gpointer data)
 {
+    nyx_charger_event_t event = GPOINTER_TO_INT(data);
 	TurnChargingOff("charge complete");
 
 	POWERDLOG(LOG_INFO,"In %s",__func__);
@@ -558,7 +901,7 @@ StateChargeComplete(nyx_charger_event_t event)
  * @retval
  */
 static ChargeState
-StateFault(nyx_charger_event_t event)
+StateFault(gpointer data)
 {
     TurnChargingOff("charging fault (columbs > 120% ACR).");
 
@@ -668,6 +1011,68 @@ BatteryTemperatureCriticalShutdown(nyx_battery_status_t *batt)
 }
 
 
+/**
+ * @brief Predictive thermal check, run with every battery poll.
+ *
+ * Charging is turned off as soon as the temperature trend predicts the battery will reach its
+ * charging limit (or the shutdown limit when there is none) within CHARGE_THERMAL_HORIZON_S,
+ * instead of waiting for the limit to be crossed. Charging resumes once the battery is no
+ * longer heating up and is CHARGE_THERMAL_RESUME_MARGIN_C below the limit.
+ */
+
+#define CHARGE_THERMAL_HORIZON_S	180
+#define CHARGE_THERMAL_RESUME_MARGIN_C	3
+
+static int
+ChargeThermalLimit(void)
+{
+    int limit = battery_ctia_params.battery_crit_max_temp ?
+                battery_ctia_params.battery_crit_max_temp : batterycheck_maxtemp();
+
+    if (battery_ctia_params.charge_max_temp_c)
+        limit = MIN(limit, battery_ctia_params.charge_max_temp_c);
+    return limit;
+}
+
+void
+ChargingLogicThermalCheck(void)
+{
+    nyx_battery_status_t state;
+    double slope = 0;
+    int limit, seconds;
+
+    if (gChargeConfig.skip_battery_check || gChargeConfig.disable_charging)
+        return;
+
+    limit = ChargeThermalLimit();
+    seconds = battery_thermal_seconds_to(limit);
+    battery_thermal_slope(&slope);
+
+    if (!gCurrentChargeState.thermal_hold)
+    {
+        if (gCurrentChargeState.charging_enabled != CHARGING_ENABLED ||
+            seconds < 0 || seconds > CHARGE_THERMAL_HORIZON_S)
+            return;
+
+        POWERDLOG(LOG_WARNING, "Battery temperature predicted to reach %dC in %ds (%.2fC/min)",
+                  limit, seconds, slope);
+
+        gCurrentChargeState.thermal_hold = true;
+        TurnChargingOff("battery temperature predicted to reach the limit");
+        return;
+    }
+
+    battery_read(&state);
+    if (seconds >= 0 || state.temperature > limit - CHARGE_THERMAL_RESUME_MARGIN_C)
+        return;
+
+    POWERDLOG(LOG_INFO, "Battery cooled down to %dC (%.2fC/min), charging allowed again",
+              state.temperature, slope);
+
+    gCurrentChargeState.thermal_hold = false;
+    ChargingLogicUpdate(NYX_NO_NEW_EVENT);
+}
+
 static bool
 BatteryTemperatureLow(nyx_battery_status_t *batt)
 {
@@ -695,13 +1100,13 @@ void handle_charger_event(nyx_charger_event_t event)
 	}
 	if(event & NYX_BATTERY_CRITICAL_VOLTAGE) {
 		if(!ChargerIsCharging())
-			_JumpToShutdownState("battery voltage below threshold");
+			_JumpToShutdownState("battery voltage below threshold", true);
 	}
 	if(event & NYX_BATTERY_TEMPERATURE_LIMIT) {
 		nyx_battery_status_t batt;
 		battery_read(&batt);
 		if(BatteryTemperatureCriticalShutdown(&batt))
-			_JumpToShutdownState("battery temperature above max allowed");
+			_JumpToShutdownState("battery temperature above max allowed", true);
 		else if(BatteryTemperatureHigh(&batt) || BatteryTemperatureLow(&batt))
 			TurnChargingOff("charging temperature is above / below the limits allowed");
 	}
@@ -26,12 +26,6 @@
 
 
 typedef int ChargeState;
-typedef ChargeState (*ChargeStateProc)(nyx_charger_event_t event);
-
-struct ChargeStateNode {
-    ChargeState state;
-    ChargeStateProc function;
-};
 
 
 /** Charging state machine */
@@ -48,9 +42,26 @@ enum {
     kChargeStateLast,
 };
 
+/**
+ * @brief Phase of the current (or last) charge cycle, detected from the battery samples.
+ */
+typedef enum {
+    kChargePhaseNone,
+    kChargePhaseConstantCurrent,
+    kChargePhaseTaper,
+    kChargePhaseDone,
+} ChargePhase;
+
 void ChargingLogicUpdate(nyx_charger_event_t event);
 
+void ChargePhaseUpdate(nyx_battery_status_t *state);
+ChargePhase ChargePhaseGet(void);
+const char *ChargePhaseName(ChargePhase phase);
+void ChargePhaseDurations(int *cc_s, int *taper_s);
+
 void ChargingLogicResetError(void);
+void ChargingLogicThermalCheck(void);
+void ChargingLogicCurrentLimitUpdate(void);
 
 bool BatteryDischarging(void);
 void _current_sample_reset(void);
@@ -0,0 +1,179 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file overcharge.c
+ *
+ * @brief Overcharge detection: the raw coulomb count compared to the aged full capacity.
+ *
+ * Thresholds are read from the [battery] section of powerd.conf:
+ *
+ * overcharge_threshold_percent : fault limit, in percent of full_mAh * age / 100 (default 120).
+ * overcharge_window            : number of recent samples considered (default 4).
+ * overcharge_window_faults     : samples of the window over the limit to raise the fault (default 4).
+ *
+ * The state of the detector is served by luna://com.palm.power/com/palm/power/overchargeStatus.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "config.h"
+#include "logging.h"
+#include "overcharge.h"
+
+#define LOG_DOMAIN "OVERCHARGE: "
+
+/* @brief The detector used by the charging logic, for the diagnostics. */
+static OverchargeDetector *overcharge_detector_published = NULL;
+
+/*
+ * @brief The gauge reports capacity_full40 and age as floating point values that drift slightly
+ * between reads. The window is only restarted when the fault limit moves by more than this.
+ */
+#define OVERCHARGE_LIMIT_TOLERANCE_PERCENT	1
+
+static void
+overcharge_detector_limits(OverchargeDetector *detector, nyx_battery_status_t *state)
+{
+	double base_mAh = state->capacity_full40 * state->age / 100;
+	bool first = !detector->valid;
+	int i;
+
+	detector->full_mAh = state->capacity_full40;
+	detector->age = state->age;
+	detector->valid = true;
+
+	detector->level_percent[0] = 100;
+	detector->level_percent[1] = 110;
+	detector->level_percent[2] = gChargeConfig.overcharge_threshold_percent;
+
+	for (i = 0; i < OVERCHARGE_LEVELS; i++)
+		detector->limit_mAh[i] = base_mAh * detector->level_percent[i] / 100;
+
+	/* Samples compared to a limit that moved noticeably say nothing about the new one. */
+	if (!first && ABS(detector->limit_mAh[OVERCHARGE_LEVELS - 1] - detector->window_limit_mAh) <=
+	    detector->window_limit_mAh * OVERCHARGE_LIMIT_TOLERANCE_PERCENT / 100)
+		return;
+
+	detector->window_limit_mAh = detector->limit_mAh[OVERCHARGE_LEVELS - 1];
+	detector->window_size = CLAMP(gChargeConfig.overcharge_window, 1, OVERCHARGE_MAX_WINDOW);
+	detector->window_faults = CLAMP(gChargeConfig.overcharge_window_faults, 1, detector->window_size);
+	detector->window_head = 0;
+	detector->window_count = 0;
+	detector->window_over = 0;
+
+	POWERDLOG(LOG_DEBUG, "%s: full %g mAh, age %g, fault limit %g mAh", __func__,
+	          detector->full_mAh, detector->age, detector->limit_mAh[OVERCHARGE_LEVELS - 1]);
+}
+
+/**
+ * @brief Feed a battery sample to the detector.
+ *
+ * @param fault  set when the overcharge fault is raised
+ *
+ * @retval the diagnostic level (in percent) reached by the sample, 0 if under every level.
+ */
+int
+overcharge_detector_update(OverchargeDetector *detector, nyx_battery_status_t *state, bool *fault)
+{
+	bool over;
+	int i;
+
+	if (!detector->valid || detector->full_mAh != state->capacity_full40 ||
+	    detector->age != state->age)
+		overcharge_detector_limits(detector, state);
+
+	overcharge_detector_published = detector;
+
+	detector->samples++;
+	detector->last_raw_mAh = state->capacity_raw;
+	detector->diag_level = 0;
+	for (i = OVERCHARGE_LEVELS - 1; i >= 0; i--)
+	{
+		if (state->capacity_raw >= detector->limit_mAh[i])
+		{
+			detector->diag_level = detector->level_percent[i];
+			break;
+		}
+	}
+
+	over = state->capacity_raw > detector->limit_mAh[OVERCHARGE_LEVELS - 1];
+
+	if (detector->window_count == detector->window_size)
+		detector->window_over -= detector->window[detector->window_head];
+	else
+		detector->window_count++;
+
+	detector->window[detector->window_head] = over;
+	detector->window_over += over;
+	detector->window_head = (detector->window_head + 1) % detector->window_size;
+
+	if (over)
+	{
+		POWERDLOG(LOG_INFO, "raw = (%g) > %d%% of (full_mAh [%g] * age [%g] / 100) = (%g), "
+		          "%d of the last %d samples",
+		          state->capacity_raw, detector->level_percent[OVERCHARGE_LEVELS - 1],
+		          detector->full_mAh, detector->age, detector->limit_mAh[OVERCHARGE_LEVELS - 1],
+		          detector->window_over, detector->window_count);
+	}
+
+	*fault = detector->window_over >= detector->window_faults;
+	if (*fault)
+		detector->faults++;
+
+	return detector->diag_level;
+}
+
+bool
+overchargeStatusQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	OverchargeDetector *detector = overcharge_detector_published;
+	GString *buffer = g_string_sized_new(256);
+	int i;
+
+	g_string_append(buffer, "{\"returnValue\":true");
+	if (detector && detector->valid)
+	{
+		g_string_append_printf(buffer, ",\"full_mAh\":%g,\"age\":%g,\"raw_mAh\":%g,"
+		                       "\"diag_level\":%d,\"samples\":%u,\"faults\":%u,"
+		                       "\"window\":%d,\"window_samples\":%d,\"window_over\":%d,"
+		                       "\"window_faults\":%d,\"limits\":[",
+		                       detector->full_mAh, detector->age, detector->last_raw_mAh,
+		                       detector->diag_level, detector->samples, detector->faults,
+		                       detector->window_size, detector->window_count,
+		                       detector->window_over, detector->window_faults);
+		for (i = 0; i < OVERCHARGE_LEVELS; i++)
+			g_string_append_printf(buffer, "%s{\"percent\":%d,\"mAh\":%g}", i ? "," : "",
+			                       detector->level_percent[i], detector->limit_mAh[i]);
+		g_string_append_c(buffer, ']');
+	}
+	g_string_append_c(buffer, '}');
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
@@ -0,0 +1,69 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _OVERCHARGE_H_
+#define _OVERCHARGE_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+#include <nyx/nyx_client.h>
+
+/* @brief Upper bound of [battery] overcharge_window. */
+#define OVERCHARGE_MAX_WINDOW	32
+
+/* @brief Diagnostic levels, in percent of the aged full capacity. The last one is configurable. */
+#define OVERCHARGE_LEVELS	3
+
+/**
+ * @brief Overcharge detector.
+ *
+ * The limits derived from capacity_full40 and age are cached and only recomputed when either of
+ * them changes; the window is restarted only if that moves the fault limit by more than 1%. The
+ * fault is raised once at least window_faults of the last window samples are over the fault limit.
+ */
+typedef struct {
+	/* cache key of the limits */
+	double  full_mAh;
+	double  age;
+	bool    valid;
+
+	int     level_percent[OVERCHARGE_LEVELS];
+	double  limit_mAh[OVERCHARGE_LEVELS];
+
+	bool    window[OVERCHARGE_MAX_WINDOW];
+	double  window_limit_mAh;	/* fault limit when the window was started */
+	int     window_size;
+	int     window_faults;	/* overcharge_window_faults, within [1, window_size] */
+	int     window_head;
+	int     window_count;	/* samples in the window */
+	int     window_over;	/* samples over the fault limit in the window */
+
+	int     diag_level;	/* highest level reached by the last sample, 0 if none */
+	double  last_raw_mAh;
+	guint   samples;
+	guint   faults;
+} OverchargeDetector;
+
+int overcharge_detector_update(OverchargeDetector *detector, nyx_battery_status_t *state,
+                               bool *fault);
+
+bool overchargeStatusQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _OVERCHARGE_H_
@@ -50,6 +50,8 @@
 
 #include "battery.h"
 #include "timeout_alarm.h"
+#include "suspend_trace.h"
+#include "wakeup_stats.h"
 
 #define LOG_DOMAIN "POWERD-SUSPEND: "
 
@@ -107,6 +109,7 @@ _ParseWakeupSources(int resumeType)
     if (kResumeTypeKernel != resumeType)
     {
         POWERDLOG(LOG_INFO, "Wakeup Source: [ 0.0 ] %s () %s (0)", resume_type_descriptions[resumeType], resume_type_descriptions[resumeType]);
+        wakeup_stats_source(resume_type_descriptions[resumeType]);
         goto done;
     }
 
@@ -139,6 +142,7 @@ cleanup:
     if (wakeup_source_list != NULL) {
         for (i=0; wakeup_source_list[i] != NULL ;i++) {
             POWERDLOG(LOG_INFO, "Wakeup Source: %s", wakeup_source_list[i]);
+            wakeup_stats_source(wakeup_source_list[i]);
         }
         g_strfreev(wakeup_source_list);
     }
@@ -162,10 +166,17 @@ bool resumeSignal(LSHandle *sh,
 	if(registration)
 		goto out;
 
+	ClockGetTime(&sTimeOnWake);
+	clock_gettime(CLOCK_REALTIME, &sWakeRTC);
+	suspend_trace_resumed(&sTimeOnWake, &sWakeRTC);
+	wakeup_stats_resume(&sTimeOnWake, &sWakeRTC);
+
 	resumetype = json_object_get_boolean(json_object_object_get(object, "resumetype"));
 
 	if(resumetype <= kResumeTypeNonIdle)
 	{
+		/* The monotonic clock stops while suspended, so drop whatever we sampled before. */
+		battery_sample_invalidate();
 		battery_set_wakeup_percentage(false,false);
 		_ParseWakeupSources(resumetype);
 	}
@@ -187,6 +198,12 @@ bool suspendedSignal(LSHandle *sh,
 		goto out;
 
 	POWERDLOG(LOG_INFO,"Received Suspended signal");
+	ClockGetTime(&sTimeOnSuspended);
+	clock_gettime(CLOCK_REALTIME, &sSuspendRTC);
+	suspend_trace_suspended(&sTimeOnSuspended, &sSuspendRTC);
+	wakeup_stats_suspended(&sTimeOnSuspended);
+
+	battery_sample_invalidate();
 	battery_set_wakeup_percentage(false,true);
 
 out:
@@ -34,6 +34,15 @@ DECLARE_LSMETHOD(identifyCallback);
 
 DECLARE_LSMETHOD(batteryStatusQuery);
 DECLARE_LSMETHOD(chargerStatusQuery);
+DECLARE_LSMETHOD(batteryHistoryQuery);
+DECLARE_LSMETHOD(batterySampleCacheQuery);
+DECLARE_LSMETHOD(batterySignalStatsQuery);
+DECLARE_LSMETHOD(stateMachineStatsQuery);
+DECLARE_LSMETHOD(overchargeStatusQuery);
+DECLARE_LSMETHOD(suspendStatsQuery);
+DECLARE_LSMETHOD(wakeupStatsQuery);
+DECLARE_LSMETHOD(activityQuery);
+DECLARE_LSMETHOD(clientRegistryQuery);
 
 DECLARE_LSMETHOD(suspendRequestRegister);
 DECLARE_LSMETHOD(suspendRequestAck);
@@ -57,6 +66,15 @@ LSMethod com_palm_power_methods[] = {
 
     { "batteryStatusQuery", batteryStatusQuery },
     { "chargerStatusQuery", chargerStatusQuery },
+    { "batteryHistory", batteryHistoryQuery },
+    { "batterySampleCache", batterySampleCacheQuery },
+    { "batterySignalStats", batterySignalStatsQuery },
+    { "stateMachineStats", stateMachineStatsQuery },
+    { "overchargeStatus", overchargeStatusQuery },
+    { "suspendStats", suspendStatsQuery },
+    { "wakeupStats", wakeupStatsQuery },
+    { "activityQuery", activityQuery },
+    { "clientRegistry", clientRegistryQuery },
 
     /* suspend methods*/
 
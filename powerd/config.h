@@ -39,11 +39,94 @@ typedef struct chargeConfig
 
     const char *preference_dir;
 
+	int battery_sample_window_ms;
+	int estimate_time_constant_s;
+
+	int signal_deadband_percent;
+	int signal_deadband_temperature_c;
+	int signal_deadband_voltage_mv;
+	int signal_deadband_current_ma;
+	int signal_min_interval_ms;
+	int signal_max_interval_s;
+
+	int poll_min_interval_s;
+	int poll_max_interval_s;
+
+	int charger_event_window_ms;
+
+	int overcharge_threshold_percent;
+	int overcharge_window;
+	int overcharge_window_faults;
+
+	const char *wakeup_percent_table;
+	int wakeup_min_percent;
+	int wakeup_margin_minutes;
+
+	const char *charger_current_limit_path;
+	int charger_current_limit_hysteresis_ma;
+
+	int activity_renew_slack_ms;
+	int activity_long_held_s;
+	int suspend_request_ack_grace_ms;
+	int prepare_suspend_ack_grace_ms;
+
 	int fasthalt;
 	int maxtemp;
 	int temprate;
 }chargeConfig_t;
 
+/**
+ * @brief Built-in defaults, before powerd.conf is applied. Shared by powerd (config.c) and
+ * chargesim so that the simulator replays traces with the same tuning as the device.
+ */
+#define CHARGE_CONFIG_DEFAULTS(preference_dir_)                 \
+{                                                               \
+    .debug = false,                                             \
+                                                                \
+    .skip_battery_check = false,                                \
+    .fake_battery = false,                                      \
+    .disable_charging = false,                                  \
+    .disable_overcharge_check = false,                          \
+    .skip_battery_authentication = false,                       \
+                                                                \
+    .preference_dir = preference_dir_,                          \
+                                                                \
+    .battery_sample_window_ms = 1000,                           \
+    .estimate_time_constant_s = 120,                            \
+                                                                \
+    .signal_deadband_percent = 1,                               \
+    .signal_deadband_temperature_c = 2,                         \
+    .signal_deadband_voltage_mv = 0,                            \
+    .signal_deadband_current_ma = 0,                            \
+    .signal_min_interval_ms = 1000,                             \
+    .signal_max_interval_s = 600,                               \
+                                                                \
+    .poll_min_interval_s = 30,                                  \
+    .poll_max_interval_s = 600,                                 \
+                                                                \
+    .charger_event_window_ms = 50,                              \
+                                                                \
+    .overcharge_threshold_percent = 120,                        \
+    .overcharge_window = 4,                                     \
+    .overcharge_window_faults = 4,                              \
+                                                                \
+    .wakeup_percent_table = "20,13,11,9,6,5,4,3,2,1",           \
+    .wakeup_min_percent = 5,                                    \
+    .wakeup_margin_minutes = 120,                               \
+                                                                \
+    .charger_current_limit_path = "",                           \
+    .charger_current_limit_hysteresis_ma = 100,                 \
+                                                                \
+    .activity_renew_slack_ms = 1000,                            \
+    .activity_long_held_s = 600,                                \
+    .suspend_request_ack_grace_ms = 5000,                       \
+    .prepare_suspend_ack_grace_ms = 5000,                       \
+                                                                \
+    .fasthalt = 0,                                              \
+    .maxtemp = 0, /* defaults in batterypoll.c */               \
+    .temprate = 0,                                              \
+}
+
 extern chargeConfig_t gChargeConfig;
 
 int config_init();
@@ -32,6 +32,7 @@
 #include "debug.h"
 #include "timesaver.h"
 #include "logging.h"
+#include "config.h"
 
 static GMainLoop *mainloop = NULL;
 static LSHandle* private_sh = NULL;
@@ -103,6 +104,13 @@ main(int argc, char **argv)
 
     g_option_context_free (ctx);
 
+    if (maxtemp)
+        gChargeConfig.maxtemp = maxtemp;
+    if (temprate)
+        gChargeConfig.temprate = temprate;
+    if (fasthalt)
+        gChargeConfig.fasthalt = 1;
+
     // FIXME integrate this into TheOneInit()
     LOGInit();
     LOGSetHandler(LOGSyslog);
@@ -0,0 +1,494 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file chargesim.c
+ *
+ * @brief Deterministic trace replay of the battery and charging logic.
+ *
+ * The charging modules are linked unchanged against an in-memory nyx, a bus that only counts
+ * signals and calls, and a virtual clock driven by the trace. Replaying the same trace always
+ * produces the same report, so changes to the charging logic can be compared by diffing reports.
+ * With POWERD_BUILD_SIMULATOR, ctest replays every traces/<name>.trace that has a checked-in
+ * traces/<name>.expected report and fails when the report changes.
+ *
+ * Trace format, one record per line, '#' starts a comment:
+ *
+ *     batteries <n>
+ *     chargers <n>
+ *     <t_ms> battery <dev> [percent=N] [temperature=N] [current=N] [avg_current=N] [voltage=N]
+ *                          [capacity=N] [capacity_raw=N] [full40=N] [age=N] [present=0|1]
+ *     <t_ms> charger <dev> [connected=none|pc|wall|inductive|direct]
+ *                          [powered=none|usb|inductive|direct] [max_current=N] [serial=S]
+ *     <t_ms> event <dev> <CONNECTED|DISCONNECTED|FAULT|COMPLETE|RESTART|PRESENT|ABSENT|
+ *                         CRITICAL_VOLTAGE|TEMPERATURE_LIMIT>
+ *
+ * Between records the virtual clock jumps from one timer expiry to the next, so the adaptive
+ * battery poll (a GTimerSource reading the virtual clock) and the glib timeouts of luna_sim.c
+ * expire as they would on the device. Each jump is reported as a wakeup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+#include "init.h"
+#include "config.h"
+#include "statemachine.h"
+#include "sim.h"
+
+/**
+ * @brief Simulator config: the built-in defaults of powerd. There is no preference directory, so
+ * no fast halt record is read or written.
+ */
+chargeConfig_t gChargeConfig = CHARGE_CONFIG_DEFAULTS(NULL);
+
+typedef struct {
+    const char *name;
+    int         value;
+} SimKeyword;
+
+static const SimKeyword sim_connected[] = {
+    { "none",      NYX_CHARGER_NO_CONNECTED },
+    { "pc",        NYX_CHARGER_PC_CONNECTED },
+    { "wall",      NYX_CHARGER_WALL_CONNECTED },
+    { "inductive", NYX_CHARGER_INDUCTIVE_CONNECTED },
+    { "direct",    NYX_CHARGER_DIRECT_CONNECTED },
+    { NULL, 0 }
+};
+
+static const SimKeyword sim_powered[] = {
+    { "none",      NYX_CHARGER_NO_POWERED },
+    { "usb",       NYX_CHARGER_USB_POWERED },
+    { "inductive", NYX_CHARGER_INDUCTIVE_POWERED },
+    { "direct",    NYX_CHARGER_DIRECT_POWERED },
+    { NULL, 0 }
+};
+
+static const SimKeyword sim_events[] = {
+    { "CONNECTED",         NYX_CHARGER_CONNECTED },
+    { "DISCONNECTED",      NYX_CHARGER_DISCONNECTED },
+    { "FAULT",             NYX_CHARGER_FAULT },
+    { "COMPLETE",          NYX_CHARGE_COMPLETE },
+    { "RESTART",           NYX_CHARGE_RESTART },
+    { "PRESENT",           NYX_BATTERY_PRESENT },
+    { "ABSENT",            NYX_BATTERY_ABSENT },
+    { "CRITICAL_VOLTAGE",  NYX_BATTERY_CRITICAL_VOLTAGE },
+    { "TEMPERATURE_LIMIT", NYX_BATTERY_TEMPERATURE_LIMIT },
+    { NULL, 0 }
+};
+
+typedef enum {
+    SIM_RECORD_BATTERY,
+    SIM_RECORD_CHARGER,
+    SIM_RECORD_EVENT,
+} SimRecordType;
+
+typedef struct {
+    long long     time_ms;
+    SimRecordType type;
+    int           device;
+    int           line;
+    char        **args;     /* key=value pairs, or the event name */
+} SimRecord;
+
+static GPtrArray *sim_records = NULL;
+static unsigned int sim_wakeups = 0;
+
+static void
+sim_log(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer data)
+{
+    if (sim_verbose)
+        printf("%10.3f log %s\n", SimClockGet() / 1000.0, message);
+}
+
+static bool
+sim_keyword(const SimKeyword *keywords, const char *name, int *value)
+{
+    for (; keywords->name; keywords++)
+    {
+        if (!strcmp(keywords->name, name))
+        {
+            *value = keywords->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+sim_trace_load(const char *path)
+{
+    gchar *contents = NULL;
+    gchar **lines;
+    GError *error = NULL;
+    int i;
+
+    if (!g_file_get_contents(path, &contents, NULL, &error))
+    {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    sim_records = g_ptr_array_new();
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    for (i = 0; lines[i]; i++)
+    {
+        gchar *comment = strchr(lines[i], '#');
+        if (comment)
+            *comment = '\0';
+
+        gchar **words = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+        int n = 0, count;
+
+        /* g_strsplit_set() leaves empty words between repeated separators */
+        for (count = 0; words[count]; count++)
+        {
+            if (*words[count])
+                words[n++] = words[count];
+            else
+                g_free(words[count]);
+        }
+        words[n] = NULL;
+
+        if (n == 0)
+        {
+            g_strfreev(words);
+            continue;
+        }
+
+        if (n == 2 && !strcmp(words[0], "batteries"))
+            sim_battery_count = CLAMP(atoi(words[1]), 0, SIM_MAX_DEVICES);
+        else if (n == 2 && !strcmp(words[0], "chargers"))
+            sim_charger_count = CLAMP(atoi(words[1]), 0, SIM_MAX_DEVICES);
+        else if (n >= 3)
+        {
+            SimRecord *record = g_new0(SimRecord, 1);
+
+            record->time_ms = g_ascii_strtoll(words[0], NULL, 10);
+            record->device = CLAMP(atoi(words[2]), 0, SIM_MAX_DEVICES - 1);
+            record->line = i + 1;
+            record->args = g_strdupv(words + 3);
+
+            if (!strcmp(words[1], "battery"))
+                record->type = SIM_RECORD_BATTERY;
+            else if (!strcmp(words[1], "charger"))
+                record->type = SIM_RECORD_CHARGER;
+            else if (!strcmp(words[1], "event"))
+                record->type = SIM_RECORD_EVENT;
+            else
+            {
+                fprintf(stderr, "%s:%d: unknown record '%s'\n", path, i + 1, words[1]);
+                g_strfreev(record->args);
+                g_free(record);
+                g_strfreev(words);
+                g_strfreev(lines);
+                return false;
+            }
+
+            g_ptr_array_add(sim_records, record);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: malformed record\n", path, i + 1);
+            g_strfreev(words);
+            g_strfreev(lines);
+            return false;
+        }
+
+        g_strfreev(words);
+    }
+
+    g_strfreev(lines);
+    return true;
+}
+
+static void
+sim_battery_apply(SimRecord *record)
+{
+    nyx_battery_status_t *status = &sim_batteries[record->device].status;
+    char **arg;
+
+    for (arg = record->args; *arg; arg++)
+    {
+        char *value = strchr(*arg, '=');
+        if (!value)
+            continue;
+        *value++ = '\0';
+
+        if (!strcmp(*arg, "percent"))
+            status->percentage = atoi(value);
+        else if (!strcmp(*arg, "temperature"))
+            status->temperature = atoi(value);
+        else if (!strcmp(*arg, "current"))
+            status->current = atoi(value);
+        else if (!strcmp(*arg, "avg_current"))
+            status->avg_current = atoi(value);
+        else if (!strcmp(*arg, "voltage"))
+            status->voltage = atoi(value);
+        else if (!strcmp(*arg, "capacity"))
+            status->capacity = g_ascii_strtod(value, NULL);
+        else if (!strcmp(*arg, "capacity_raw"))
+            status->capacity_raw = g_ascii_strtod(value, NULL);
+        else if (!strcmp(*arg, "full40"))
+            status->capacity_full40 = g_ascii_strtod(value, NULL);
+        else if (!strcmp(*arg, "age"))
+            status->age = g_ascii_strtod(value, NULL);
+        else if (!strcmp(*arg, "present"))
+            status->present = atoi(value) != 0;
+        else
+            fprintf(stderr, "line %d: unknown battery key '%s'\n", record->line, *arg);
+        value[-1] = '=';
+    }
+}
+
+static void
+sim_charger_apply(SimRecord *record)
+{
+    nyx_charger_status_t *status = &sim_chargers[record->device].status;
+    char **arg;
+
+    for (arg = record->args; *arg; arg++)
+    {
+        char *value = strchr(*arg, '=');
+        if (!value)
+            continue;
+        *value++ = '\0';
+
+        if (!strcmp(*arg, "connected"))
+        {
+            if (!sim_keyword(sim_connected, value, &status->connected))
+                fprintf(stderr, "line %d: unknown connection '%s'\n", record->line, value);
+        }
+        else if (!strcmp(*arg, "powered"))
+        {
+            if (!sim_keyword(sim_powered, value, &status->powered))
+                fprintf(stderr, "line %d: unknown power source '%s'\n", record->line, value);
+        }
+        else if (!strcmp(*arg, "max_current"))
+            status->charger_max_current = atoi(value);
+        else if (!strcmp(*arg, "serial"))
+            g_strlcpy(status->dock_serial_number, value, sizeof(status->dock_serial_number));
+        else
+            fprintf(stderr, "line %d: unknown charger key '%s'\n", record->line, *arg);
+        value[-1] = '=';
+    }
+}
+
+static int
+sim_event_parse(SimRecord *record)
+{
+    int event = 0;
+    char **arg;
+
+    for (arg = record->args; *arg; arg++)
+    {
+        int value;
+        if (sim_keyword(sim_events, *arg, &value))
+            event |= value;
+        else
+            fprintf(stderr, "line %d: unknown event '%s'\n", record->line, *arg);
+    }
+    return event;
+}
+
+/**
+ * @brief Run the main loop sources that are ready at the current virtual time and report charger
+ * changes caused by enabling / disabling charging.
+ */
+static void
+sim_settle(void)
+{
+    int i;
+
+    do {
+        while (g_main_context_iteration(NULL, FALSE))
+            ;
+
+        if (!sim_charger_changed)
+            break;
+
+        sim_charger_changed = false;
+        for (i = 0; i < sim_charger_count; i++)
+            SimChargerNotify(i);
+    } while (true);
+}
+
+static void
+sim_record_apply(SimRecord *record, bool initial)
+{
+    switch (record->type)
+    {
+    case SIM_RECORD_BATTERY:
+        sim_battery_apply(record);
+        if (!initial)
+            SimBatteryNotify(record->device);
+        break;
+    case SIM_RECORD_CHARGER:
+        sim_charger_apply(record);
+        if (!initial)
+            SimChargerNotify(record->device);
+        break;
+    case SIM_RECORD_EVENT:
+        if (!initial)
+            SimChargerEvent(record->device, sim_event_parse(record));
+        break;
+    }
+
+    if (!initial)
+        sim_settle();
+}
+
+/**
+ * @brief Virtual time at which a timer next expires, -1 if none is pending.
+ *
+ * The main loop is asked how long it would block, which covers sources of the charging logic
+ * that follow the virtual clock, and the result is compared with the next simulated timeout.
+ */
+static long long
+sim_next_wakeup(void)
+{
+    GPollFD fds[8];
+    gint priority, n_fds, timeout_ms = -1;
+    long long next = SimTimeoutNext();
+
+    g_main_context_acquire(NULL);
+    g_main_context_prepare(NULL, &priority);
+    n_fds = g_main_context_query(NULL, priority, &timeout_ms, fds, G_N_ELEMENTS(fds));
+    if (g_main_context_check(NULL, priority, fds, MIN(n_fds, (gint)G_N_ELEMENTS(fds))))
+        g_main_context_dispatch(NULL);
+    g_main_context_release(NULL);
+
+    if (timeout_ms >= 0 && (next < 0 || SimClockGet() + timeout_ms < next))
+        next = SimClockGet() + timeout_ms;
+    return next;
+}
+
+/**
+ * @brief Advance the virtual clock to until_ms, stopping at every timer expiry on the way.
+ */
+static void
+sim_run_until(long long until_ms)
+{
+    long long next;
+
+    while ((next = sim_next_wakeup()) >= 0 && next <= until_ms)
+    {
+        SimClockSet(MAX(next, SimClockGet()));
+        SimTimeoutDispatch();
+        sim_settle();
+        sim_wakeups++;
+    }
+
+    SimClockSet(until_ms);
+}
+
+static void
+sim_usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-v] TRACE\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *trace = NULL;
+    struct timespec cpu_start, cpu_end;
+    long long end_ms = 0;
+    guint i;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp(argv[arg], "-v"))
+            sim_verbose = true;
+        else if (!trace && argv[arg][0] != '-')
+            trace = argv[arg];
+        else
+        {
+            sim_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!trace)
+    {
+        sim_usage(argv[0]);
+        return 2;
+    }
+
+    g_log_set_default_handler(sim_log, NULL);
+
+    for (i = 0; i < SIM_MAX_DEVICES; i++)
+    {
+        sim_batteries[i].status.present = true;
+        sim_batteries[i].status.percentage = 50;
+        sim_batteries[i].status.temperature = 25;
+        sim_batteries[i].status.voltage = 3800;
+    }
+
+    if (!sim_trace_load(trace))
+        return 1;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+    /* Records at time 0 describe the devices as powerd finds them at boot. */
+    for (i = 0; i < sim_records->len; i++)
+    {
+        SimRecord *record = g_ptr_array_index(sim_records, i);
+        if (record->time_ms > 0)
+            break;
+        sim_record_apply(record, true);
+    }
+
+    SimClockSet(0);
+    TheOneInit();
+    sim_settle();
+
+    for (; i < sim_records->len; i++)
+    {
+        SimRecord *record = g_ptr_array_index(sim_records, i);
+
+        sim_run_until(record->time_ms);
+        sim_record_apply(record, false);
+        end_ms = record->time_ms;
+    }
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+    printf("records: %u\n", sim_records->len);
+    printf("virtual duration: %.3fs\n", end_ms / 1000.0);
+    printf("wakeups: %u\n", sim_wakeups);
+    SimBusReport();
+
+    stateMachineStatsQuery(NULL, NULL, NULL);
+    printf("state machines: %s\n", SimBusLastReply());
+
+    /* CPU time varies between runs, keep it off stdout so that reports can be diffed. */
+    fprintf(stderr, "cpu: %.3fms\n",
+            (cpu_end.tv_sec - cpu_start.tv_sec) * 1000.0 +
+            (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1000000.0);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file clock_sim.c
+ *
+ * @brief Virtual monotonic clock of the simulator, advanced by the trace rather than by time.
+ */
+
+#include <time.h>
+#include <glib.h>
+
+#include "clock.h"
+#include "sim.h"
+
+#define NSEC_PER_SEC	1000000000L
+
+static long long sim_now_ms = 0;
+
+void
+SimClockSet(long long ms)
+{
+    sim_now_ms = ms;
+}
+
+long long
+SimClockGet(void)
+{
+    return sim_now_ms;
+}
+
+void
+ClockGetTime(struct timespec *time)
+{
+    time->tv_sec = sim_now_ms / 1000;
+    time->tv_nsec = (sim_now_ms % 1000) * 1000000;
+}
+
+/**
+ * diff = a - b
+ */
+void
+ClockDiff(struct timespec *diff, struct timespec *a, struct timespec *b)
+{
+    diff->tv_sec = a->tv_sec - b->tv_sec;
+    diff->tv_nsec = a->tv_nsec - b->tv_nsec;
+
+    if (diff->tv_nsec < 0)
+    {
+        diff->tv_nsec += NSEC_PER_SEC;
+        diff->tv_sec--;
+    }
+}
+
+/**
+ * sum += b
+ */
+void
+ClockAccum(struct timespec *sum, struct timespec *b)
+{
+    sum->tv_nsec += b->tv_nsec;
+    while (sum->tv_nsec >= NSEC_PER_SEC)
+    {
+        sum->tv_nsec -= NSEC_PER_SEC;
+        sum->tv_sec++;
+    }
+    sum->tv_sec += b->tv_sec;
+}
+
+long
+ClockGetMs(struct timespec *ts)
+{
+    return ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+void
+ClockClear(struct timespec *a)
+{
+    a->tv_sec = 0;
+    a->tv_nsec = 0;
+}
@@ -0,0 +1,46 @@
+# @@@LICENSE
+#
+#      Copyright (c) 2007-2013 LG Electronics, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# LICENSE@@@
+
+#
+# powerd/powerd/sim/compare.cmake
+#
+
+# Replay TRACE through CHARGESIM and compare the report on stdout with EXPECTED. On a mismatch
+# the report is left in ACTUAL; when the change in behaviour is intended, copy ACTUAL over
+# EXPECTED and commit it together with the change.
+
+foreach(var CHARGESIM TRACE EXPECTED ACTUAL)
+	if(NOT DEFINED ${var})
+		message(FATAL_ERROR "compare.cmake: ${var} is not set")
+	endif()
+endforeach()
+
+execute_process(COMMAND ${CHARGESIM} ${TRACE}
+                OUTPUT_VARIABLE actual
+                RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "chargesim ${TRACE} exited with ${result}")
+endif()
+
+file(READ ${EXPECTED} expected)
+file(WRITE ${ACTUAL} "${actual}")
+
+if(NOT actual STREQUAL expected)
+	message(FATAL_ERROR "report of ${TRACE} differs from ${EXPECTED}, see ${ACTUAL}")
+endif()
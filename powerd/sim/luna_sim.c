@@ -0,0 +1,327 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file luna_sim.c
+ *
+ * @brief Stand-ins for the bus and the powerd services the charging modules depend on.
+ *
+ * Signals and calls are counted per URI instead of being sent, the other services are no-ops.
+ * glib timeouts run on the virtual clock: chargesim advances the clock to SimTimeoutNext() and
+ * calls SimTimeoutDispatch(), so the batteryStatus rate limit and heartbeat and the charger event
+ * window expire as they would on the device.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "subscription.h"
+#include "statuspage.h"
+#include "sim.h"
+
+bool sim_verbose = false;
+
+static GHashTable *sim_signals = NULL;	/* uri -> count */
+static GHashTable *sim_calls = NULL;	/* uri -> count */
+static GString *sim_last_reply = NULL;
+
+static void
+SimBusCount(GHashTable **table, const char *kind, const char *uri, const char *payload)
+{
+    if (!*table)
+        *table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(*table, uri));
+    g_hash_table_replace(*table, g_strdup(uri), GUINT_TO_POINTER(count + 1));
+
+    if (sim_verbose)
+        printf("%10.3f %s %s %s\n", SimClockGet() / 1000.0, kind, uri, payload);
+}
+
+static void
+SimBusPrint(GHashTable *table, const char *title)
+{
+    GList *keys, *iter;
+
+    printf("%s:\n", title);
+    if (!table)
+        return;
+
+    keys = g_list_sort(g_hash_table_get_keys(table), (GCompareFunc)strcmp);
+    for (iter = keys; iter; iter = iter->next)
+        printf("  %-64s %u\n", (char *)iter->data,
+               GPOINTER_TO_UINT(g_hash_table_lookup(table, iter->data)));
+    g_list_free(keys);
+}
+
+void
+SimBusReport(void)
+{
+    SimBusPrint(sim_signals, "signals");
+    SimBusPrint(sim_calls, "calls");
+}
+
+const char *
+SimBusLastReply(void)
+{
+    return sim_last_reply ? sim_last_reply->str : "";
+}
+
+/* luna-service2 */
+
+bool
+LSErrorInit(LSError *error)
+{
+    memset(error, 0, sizeof(*error));
+    return true;
+}
+
+void
+LSErrorFree(LSError *error)
+{
+}
+
+void
+LSErrorPrint(LSError *error, FILE *out)
+{
+}
+
+bool
+LSSignalSend(LSHandle *sh, const char *uri, const char *payload, LSError *lserror)
+{
+    SimBusCount(&sim_signals, "signal", uri, payload);
+    return true;
+}
+
+bool
+LSCall(LSHandle *sh, const char *uri, const char *payload,
+       LSFilterFunc callback, void *ctx, LSMessageToken *ret_token, LSError *lserror)
+{
+    SimBusCount(&sim_calls, "call", uri, payload);
+    return true;
+}
+
+bool
+LSCallOneReply(LSHandle *sh, const char *uri, const char *payload,
+       LSFilterFunc callback, void *ctx, LSMessageToken *ret_token, LSError *lserror)
+{
+    SimBusCount(&sim_calls, "call", uri, payload);
+    return true;
+}
+
+bool
+LSMessageReply(LSHandle *sh, LSMessage *message, const char *payload, LSError *lserror)
+{
+    if (!sim_last_reply)
+        sim_last_reply = g_string_new(NULL);
+    g_string_assign(sim_last_reply, payload);
+    return true;
+}
+
+const char *
+LSMessageGetPayload(LSMessage *message)
+{
+    return "{}";
+}
+
+const char *
+LSMessageGetMethod(LSMessage *message)
+{
+    return "";
+}
+
+/* powerd services */
+
+GMainContext *
+GetMainLoopContext(void)
+{
+    return NULL;
+}
+
+LSHandle *
+GetLunaServiceHandle(void)
+{
+    return NULL;
+}
+
+LSPalmService *
+GetPalmService(void)
+{
+    return NULL;
+}
+
+SubscriptionList *
+SubscriptionListNew(const char *key, const char **fields, int n_fields, unsigned int change_only)
+{
+    return NULL;
+}
+
+bool
+SubscriptionListAdd(SubscriptionList *list, LSHandle *sh, LSMessage *message, const int *values)
+{
+    return true;
+}
+
+void
+SubscriptionListNotify(SubscriptionList *list, const int *values, const char *payload)
+{
+}
+
+unsigned int
+SubscriptionListCount(SubscriptionList *list)
+{
+    return 0;
+}
+
+bool
+SubscriptionCancel(LSMessage *message)
+{
+    return false;
+}
+
+void
+StatusPagePublishBattery(const PowerdBatteryStatus *battery)
+{
+}
+
+void
+StatusPagePublishCharger(const PowerdChargerStatus *charger)
+{
+}
+
+/* glib timeouts */
+
+typedef struct {
+    guint       id;
+    long long   due_ms;
+    guint       interval_ms;
+    GSourceFunc function;
+    gpointer    data;
+    bool        removed;
+} SimTimeout;
+
+/* @brief Ids of the simulated timeouts start here, above the ids glib gives its own sources. */
+#define SIM_TIMEOUT_FIRST_ID	0x40000000u
+
+static GList *sim_timeouts = NULL;	/* sorted by due time, then by id */
+static guint sim_timeout_next_id = SIM_TIMEOUT_FIRST_ID;
+static SimTimeout *sim_timeout_running = NULL;
+
+static gint
+SimTimeoutCompare(gconstpointer a, gconstpointer b)
+{
+    const SimTimeout *ta = a, *tb = b;
+
+    if (ta->due_ms != tb->due_ms)
+        return ta->due_ms < tb->due_ms ? -1 : 1;
+    return ta->id < tb->id ? -1 : ta->id > tb->id;
+}
+
+guint
+g_timeout_add(guint interval, GSourceFunc function, gpointer data)
+{
+    SimTimeout *timeout = g_new0(SimTimeout, 1);
+
+    timeout->id = sim_timeout_next_id++;
+    timeout->due_ms = SimClockGet() + interval;
+    timeout->interval_ms = interval;
+    timeout->function = function;
+    timeout->data = data;
+
+    sim_timeouts = g_list_insert_sorted(sim_timeouts, timeout, SimTimeoutCompare);
+    return timeout->id;
+}
+
+guint
+g_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data)
+{
+    return g_timeout_add(interval * 1000, function, data);
+}
+
+gboolean
+g_source_remove(guint tag)
+{
+    GList *iter;
+
+    /* Idle callbacks and the battery poll are real glib sources. */
+    if (tag < SIM_TIMEOUT_FIRST_ID)
+    {
+        GSource *source = g_main_context_find_source_by_id(NULL, tag);
+        if (!source)
+            return FALSE;
+        g_source_destroy(source);
+        return TRUE;
+    }
+
+    if (sim_timeout_running && sim_timeout_running->id == tag)
+    {
+        sim_timeout_running->removed = true;
+        return TRUE;
+    }
+
+    for (iter = sim_timeouts; iter; iter = iter->next)
+    {
+        SimTimeout *timeout = iter->data;
+        if (timeout->id == tag)
+        {
+            sim_timeouts = g_list_delete_link(sim_timeouts, iter);
+            g_free(timeout);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Virtual time at which the next timeout expires, -1 if none is pending.
+ */
+long long
+SimTimeoutNext(void)
+{
+    return sim_timeouts ? ((SimTimeout *)sim_timeouts->data)->due_ms : -1;
+}
+
+/**
+ * @brief Run every timeout that has expired at the current virtual time, in expiry order.
+ */
+void
+SimTimeoutDispatch(void)
+{
+    while (sim_timeouts && ((SimTimeout *)sim_timeouts->data)->due_ms <= SimClockGet())
+    {
+        SimTimeout *timeout = sim_timeouts->data;
+        gboolean again;
+
+        sim_timeouts = g_list_delete_link(sim_timeouts, sim_timeouts);
+
+        sim_timeout_running = timeout;
+        again = timeout->function(timeout->data);
+        sim_timeout_running = NULL;
+
+        if (again && !timeout->removed)
+        {
+            timeout->due_ms = SimClockGet() + timeout->interval_ms;
+            sim_timeouts = g_list_insert_sorted(sim_timeouts, timeout, SimTimeoutCompare);
+        }
+        else
+            g_free(timeout);
+    }
+}
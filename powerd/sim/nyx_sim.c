@@ -0,0 +1,267 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file nyx_sim.c
+ *
+ * @brief In-memory stand-in for the nyx battery and charger devices.
+ *
+ * The devices hold whatever the trace last set, callbacks are only invoked when the simulator
+ * replays a record for the device.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+#include "sim.h"
+
+SimBattery sim_batteries[SIM_MAX_DEVICES];
+int sim_battery_count = 1;
+
+SimCharger sim_chargers[SIM_MAX_DEVICES];
+int sim_charger_count = 1;
+
+bool sim_charger_changed = false;
+
+static const char *sim_battery_ids[SIM_MAX_DEVICES] = { "battery0", "battery1", "battery2", "battery3" };
+static const char *sim_charger_ids[SIM_MAX_DEVICES] = { "charger0", "charger1", "charger2", "charger3" };
+
+static struct {
+    nyx_device_iterator_handle_t handle;
+    nyx_device_type_t            type;
+    int                          next;
+} sim_iterators[2];
+
+nyx_error_t
+nyx_init(void)
+{
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_device_get_iterator(nyx_device_type_t type, nyx_device_filter_t filter,
+                        nyx_device_iterator_handle_t *iterator)
+{
+    int slot = (type == NYX_DEVICE_BATTERY) ? 0 : 1;
+
+    /* The caller releases the iterator with free(). */
+    sim_iterators[slot].handle = (nyx_device_iterator_handle_t)malloc(sizeof(int));
+    sim_iterators[slot].type = type;
+    sim_iterators[slot].next = 0;
+
+    *iterator = sim_iterators[slot].handle;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_device_iterator_get_next_id(nyx_device_iterator_handle_t iterator, nyx_device_id_t *id)
+{
+    int slot;
+
+    for (slot = 0; slot < 2; slot++)
+    {
+        if (sim_iterators[slot].handle != iterator)
+            continue;
+
+        bool battery = sim_iterators[slot].type == NYX_DEVICE_BATTERY;
+        int count = battery ? sim_battery_count : sim_charger_count;
+
+        if (sim_iterators[slot].next >= count)
+        {
+            *id = NULL;
+            return NYX_ERROR_NONE;
+        }
+
+        *id = battery ? sim_battery_ids[sim_iterators[slot].next] :
+                        sim_charger_ids[sim_iterators[slot].next];
+        sim_iterators[slot].next++;
+        return NYX_ERROR_NONE;
+    }
+
+    *id = NULL;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_device_open(nyx_device_type_t type, nyx_device_id_t id, nyx_device_handle_t *handle)
+{
+    int i;
+
+    for (i = 0; i < SIM_MAX_DEVICES; i++)
+    {
+        if (type == NYX_DEVICE_BATTERY && !strcmp(id, sim_battery_ids[i]))
+        {
+            *handle = (nyx_device_handle_t)&sim_batteries[i];
+            return NYX_ERROR_NONE;
+        }
+        if (type == NYX_DEVICE_CHARGER && !strcmp(id, sim_charger_ids[i]))
+        {
+            *handle = (nyx_device_handle_t)&sim_chargers[i];
+            return NYX_ERROR_NONE;
+        }
+    }
+
+    return NYX_ERROR_GENERIC;
+}
+
+/* Battery */
+
+nyx_error_t
+nyx_battery_query_battery_status(nyx_device_handle_t handle, nyx_battery_status_t *status)
+{
+    *status = ((SimBattery *)handle)->status;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_battery_get_ctia_parameters(nyx_device_handle_t handle, nyx_battery_ctia_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->skip_battery_authentication = true;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_battery_authenticate_battery(nyx_device_handle_t handle, bool *result)
+{
+    *result = true;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_battery_set_wakeup_percentage(nyx_device_handle_t handle, int percentage)
+{
+    ((SimBattery *)handle)->wakeup_percent = percentage;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_battery_register_battery_status_callback(nyx_device_handle_t handle,
+        nyx_device_callback_function_t callback, void *context)
+{
+    ((SimBattery *)handle)->status_callback = callback;
+    ((SimBattery *)handle)->status_context = context;
+    return NYX_ERROR_NONE;
+}
+
+void
+SimBatteryNotify(int device)
+{
+    SimBattery *battery = &sim_batteries[device];
+
+    if (battery->status_callback)
+        battery->status_callback((nyx_device_handle_t)battery, NYX_CALLBACK_STATUS_DONE,
+                                 battery->status_context);
+}
+
+/* Charger */
+
+nyx_error_t
+nyx_charger_query_charger_status(nyx_device_handle_t handle, nyx_charger_status_t *status)
+{
+    *status = ((SimCharger *)handle)->status;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_charger_query_charger_event(nyx_device_handle_t handle, nyx_charger_event_t *event)
+{
+    SimCharger *charger = (SimCharger *)handle;
+
+    *event = charger->pending_event;
+    charger->pending_event = NYX_NO_NEW_EVENT;
+    return NYX_ERROR_NONE;
+}
+
+static void
+SimChargerSetCharging(SimCharger *charger, bool charging)
+{
+    charger->enabled = charging;
+    charging = charging && charger->status.powered;
+
+    if (charger->status.is_charging != charging)
+    {
+        charger->status.is_charging = charging;
+        sim_charger_changed = true;
+    }
+}
+
+nyx_error_t
+nyx_charger_enable_charging(nyx_device_handle_t handle, nyx_charger_status_t *status)
+{
+    SimCharger *charger = (SimCharger *)handle;
+
+    SimChargerSetCharging(charger, true);
+    *status = charger->status;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_charger_disable_charging(nyx_device_handle_t handle, nyx_charger_status_t *status)
+{
+    SimCharger *charger = (SimCharger *)handle;
+
+    SimChargerSetCharging(charger, false);
+    *status = charger->status;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_charger_register_charger_status_callback(nyx_device_handle_t handle,
+        nyx_device_callback_function_t callback, void *context)
+{
+    ((SimCharger *)handle)->status_callback = callback;
+    ((SimCharger *)handle)->status_context = context;
+    return NYX_ERROR_NONE;
+}
+
+nyx_error_t
+nyx_charger_register_state_change_callback(nyx_device_handle_t handle,
+        nyx_device_callback_function_t callback, void *context)
+{
+    ((SimCharger *)handle)->event_callback = callback;
+    ((SimCharger *)handle)->event_context = context;
+    return NYX_ERROR_NONE;
+}
+
+void
+SimChargerNotify(int device)
+{
+    SimCharger *charger = &sim_chargers[device];
+
+    /* Unplugging stops charging, plugging back in only charges once enabled again. */
+    charger->status.is_charging = charger->enabled && charger->status.powered;
+
+    if (charger->status_callback)
+        charger->status_callback((nyx_device_handle_t)charger, NYX_CALLBACK_STATUS_DONE,
+                                 charger->status_context);
+}
+
+void
+SimChargerEvent(int device, int event)
+{
+    SimCharger *charger = &sim_chargers[device];
+
+    charger->pending_event |= event;
+
+    if (charger->event_callback)
+        charger->event_callback((nyx_device_handle_t)charger, NYX_CALLBACK_STATUS_DONE,
+                                charger->event_context);
+}
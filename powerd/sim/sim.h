@@ -0,0 +1,81 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+/**
+ * Shared state of the charging logic simulator.
+ */
+
+#include <stdbool.h>
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+#define SIM_MAX_DEVICES	4
+
+/**
+ * @brief In-memory battery and charger devices, set by the trace and read through the nyx API.
+ */
+typedef struct {
+    nyx_battery_status_t status;
+    int                  wakeup_percent;
+
+    nyx_device_callback_function_t status_callback;
+    void                          *status_context;
+} SimBattery;
+
+typedef struct {
+    nyx_charger_status_t status;
+    int                  pending_event;
+    bool                 enabled;
+
+    nyx_device_callback_function_t status_callback;
+    void                          *status_context;
+    nyx_device_callback_function_t event_callback;
+    void                          *event_context;
+} SimCharger;
+
+extern SimBattery sim_batteries[SIM_MAX_DEVICES];
+extern int sim_battery_count;
+
+extern SimCharger sim_chargers[SIM_MAX_DEVICES];
+extern int sim_charger_count;
+
+/* @brief Set by the charger when enabling / disabling charging changed its status. */
+extern bool sim_charger_changed;
+
+void SimBatteryNotify(int device);
+void SimChargerNotify(int device);
+void SimChargerEvent(int device, int event);
+
+/* Virtual clock */
+void SimClockSet(long long ms);
+long long SimClockGet(void);
+
+/* glib timeouts on the virtual clock */
+long long SimTimeoutNext(void);
+void SimTimeoutDispatch(void);
+
+/* Bus */
+extern bool sim_verbose;
+
+void SimBusReport(void);
+const char *SimBusLastReply(void);
+
+#endif // _SIM_H_
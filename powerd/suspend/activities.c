@@ -0,0 +1,496 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file activities.c
+ *
+ * @brief Local table of the activities held through powerd.
+ *
+ * Every activity started through activityStart is kept by id with its owner, start time and
+ * lease. The leases are also kept in a min-heap ordered by the time something has to happen
+ * to them, so that a single timer serves the whole table.
+ *
+ * Sleepd holds off suspend until the lease it last accepted expires. A renewal is only
+ * forwarded when that lease is about to run out (within activity_renew_slack_ms) or when
+ * it shortens the lease; the others are answered locally and just move the local deadline.
+ * The lease only counts as held by sleepd once sleepd acked it, so renewals keep being
+ * forwarded until one is accepted.
+ * If the owner keeps renewing, the lease is refreshed with sleepd shortly before sleepd's copy
+ * would expire, so the suspend decision never differs from forwarding every renewal.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "config.h"
+#include "init.h"
+#include "logging.h"
+#include "activities.h"
+
+#define LOG_DOMAIN "ACTIVITIES: "
+
+#define SLEEPD_ACTIVITY_START "luna://com.palm.sleep/com/palm/power/activityStart"
+
+typedef struct {
+	char   *id;
+	char   *client;
+	gint64  start_ms;	/* times are monotonic, see activities_now_ms() */
+	long    duration_ms;
+	gint64  deadline_ms;	/* last renewal + duration */
+	gint64  forwarded_ms;	/* deadline sleepd accepted, 0 if none */
+	gint64  sent_ms;	/* deadline last sent to sleepd */
+	bool    rejected;	/* sleepd refused the last deadline sent */
+	gint64  due_ms;		/* heap key */
+	guint   renewals;
+	guint   forwarded;
+	bool    long_held;
+	guint   heap_index;
+} Activity;
+
+static struct {
+	GHashTable *table;	/* id -> Activity */
+	GPtrArray  *heap;	/* Activity, min-heap on due_ms */
+	guint       timer;
+	gint64      timer_due_ms;
+
+	guint       started;
+	guint       ended;
+	guint       expired;	/* lease ran out without activityEnd */
+	guint       renewals;
+	guint       renewals_skipped;
+	guint       refreshes;
+	guint       rejected;
+} activities;
+
+/**
+ * @brief Monotonic time in ms. A long would overflow after 24 days of uptime on 32-bit targets.
+ */
+static gint64
+activities_now_ms(void)
+{
+	return g_get_monotonic_time() / 1000;
+}
+
+/* Min-heap */
+
+#define HEAP_AT(i) ((Activity *)g_ptr_array_index(activities.heap, (i)))
+
+static void
+activities_heap_swap(guint i, guint j)
+{
+	Activity *a = HEAP_AT(i);
+	Activity *b = HEAP_AT(j);
+
+	g_ptr_array_index(activities.heap, i) = b;
+	g_ptr_array_index(activities.heap, j) = a;
+	b->heap_index = i;
+	a->heap_index = j;
+}
+
+static void
+activities_heap_fix(guint i)
+{
+	guint n = activities.heap->len;
+
+	while (i > 0 && HEAP_AT(i)->due_ms < HEAP_AT((i - 1) / 2)->due_ms)
+	{
+		activities_heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	for (;;)
+	{
+		guint smallest = i;
+		guint left = 2 * i + 1;
+		guint right = left + 1;
+
+		if (left < n && HEAP_AT(left)->due_ms < HEAP_AT(smallest)->due_ms)
+			smallest = left;
+		if (right < n && HEAP_AT(right)->due_ms < HEAP_AT(smallest)->due_ms)
+			smallest = right;
+		if (smallest == i)
+			break;
+
+		activities_heap_swap(i, smallest);
+		i = smallest;
+	}
+}
+
+static void
+activities_heap_push(Activity *activity)
+{
+	activity->heap_index = activities.heap->len;
+	g_ptr_array_add(activities.heap, activity);
+	activities_heap_fix(activity->heap_index);
+}
+
+static void
+activities_heap_remove(Activity *activity)
+{
+	guint i = activity->heap_index;
+	guint last = activities.heap->len - 1;
+
+	if (i != last)
+		activities_heap_swap(i, last);
+	g_ptr_array_remove_index_fast(activities.heap, last);
+	if (i < activities.heap->len)
+		activities_heap_fix(i);
+}
+
+/* Leases */
+
+static void
+activities_free(gpointer data)
+{
+	Activity *activity = data;
+
+	g_free(activity->id);
+	g_free(activity->client);
+	g_free(activity);
+}
+
+/**
+ * @brief Recompute when the activity next needs attention: a refresh of sleepd's lease
+ * ahead of its expiry while the local lease outlives it, the expiry otherwise. After a
+ * rejection only the owner's own renewals are forwarded.
+ */
+static void
+activities_update_due(Activity *activity)
+{
+	if (!activity->rejected && activity->deadline_ms > activity->sent_ms)
+		activity->due_ms = activity->sent_ms - gChargeConfig.activity_renew_slack_ms;
+	else
+		activity->due_ms = activity->deadline_ms;
+
+	activities_heap_fix(activity->heap_index);
+}
+
+static void
+activities_check_long_held(Activity *activity, gint64 now_ms)
+{
+	long held_s = (long)((now_ms - activity->start_ms) / 1000);
+
+	if (!activity->long_held && gChargeConfig.activity_long_held_s > 0 &&
+	    held_s >= gChargeConfig.activity_long_held_s)
+	{
+		activity->long_held = true;
+		POWERDLOG(LOG_WARNING, "activity %s of %s held for %lds (%u renewals)",
+		          activity->id, activity->client, held_s, activity->renewals);
+	}
+}
+
+static void activities_arm(void);
+
+static void
+activities_remove(Activity *activity)
+{
+	activities_heap_remove(activity);
+	g_hash_table_remove(activities.table, activity->id);
+}
+
+/**
+ * @brief Sleepd answered the activityStart that sent deadline_ms for the activity.
+ */
+static void
+activities_start_reply(const char *id, gint64 deadline_ms, LSMessage *reply)
+{
+	Activity *activity = g_hash_table_lookup(activities.table, id);
+	bool accepted = false;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(reply));
+	if (!is_error(object))
+	{
+		accepted = json_object_get_boolean(json_object_object_get(object, "returnValue"));
+		json_object_put(object);
+	}
+
+	/* Only the answer to the last deadline sent matters */
+	if (!activity || deadline_ms != activity->sent_ms)
+		return;
+
+	if (accepted)
+	{
+		activity->forwarded_ms = deadline_ms;
+		activity->rejected = false;
+	}
+	else
+	{
+		POWERDLOG(LOG_DEBUG, "activity %s of %s rejected by sleepd", activity->id, activity->client);
+		activities.rejected++;
+
+		if (!activity->forwarded_ms)
+		{
+			/* Sleepd never held it, nothing to keep track of */
+			activities_remove(activity);
+			activities_arm();
+			return;
+		}
+
+		activity->sent_ms = activity->forwarded_ms;
+		activity->rejected = true;
+	}
+
+	activities_update_due(activity);
+	activities_arm();
+}
+
+typedef struct {
+	char      *id;
+	gint64     deadline_ms;
+	LSMessage *message;	/* call to answer with sleepd's reply, NULL for a refresh */
+} ActivityForward;
+
+static bool
+activities_forward_cb(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+	ActivityForward *forward = ctx;
+
+	activities_start_reply(forward->id, forward->deadline_ms, reply);
+
+	if (forward->message)
+	{
+		if (LSMessageGetConnection(forward->message) &&
+		    !LSMessageReply(LSMessageGetConnection(forward->message), forward->message,
+		                    LSMessageGetPayload(reply), NULL))
+			POWERDLOG(LOG_WARNING, "%s could not send reply.", __FUNCTION__);
+		LSMessageUnref(forward->message);
+	}
+
+	g_free(forward->id);
+	g_free(forward);
+	return true;
+}
+
+/**
+ * @brief Send sleepd an activityStart for deadline_ms, and answer message (if any) with
+ * sleepd's reply.
+ */
+void
+activities_forward(LSMessage *message, const char *id, gint64 deadline_ms, const char *payload)
+{
+	ActivityForward *forward = g_new0(ActivityForward, 1);
+	Activity *activity = g_hash_table_lookup(activities.table, id);
+
+	forward->id = g_strdup(id);
+	forward->deadline_ms = deadline_ms;
+	forward->message = message;
+	if (message)
+		LSMessageRef(message);
+
+	if (activity)
+	{
+		activity->sent_ms = deadline_ms;
+		activity->forwarded++;
+		activities_update_due(activity);
+		activities_arm();
+	}
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSCallOneReply(GetLunaServiceHandle(), SLEEPD_ACTIVITY_START, payload,
+	                    activities_forward_cb, forward, NULL, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+		if (message)
+			LSMessageUnref(message);
+		g_free(forward->id);
+		g_free(forward);
+	}
+}
+
+static void
+activities_refresh(Activity *activity, gint64 now_ms)
+{
+	long duration_ms = (long)(activity->deadline_ms - now_ms);
+	char *payload = g_strdup_printf("{\"id\":\"%s\",\"duration_ms\":%ld}", activity->id, duration_ms);
+
+	activities.refreshes++;
+	activities_forward(NULL, activity->id, activity->deadline_ms, payload);
+	g_free(payload);
+}
+
+static gboolean
+activities_timeout(gpointer data)
+{
+	gint64 now_ms = activities_now_ms();
+
+	activities.timer = 0;
+
+	while (activities.heap->len && HEAP_AT(0)->due_ms <= now_ms)
+	{
+		Activity *activity = HEAP_AT(0);
+
+		if (activity->deadline_ms <= now_ms)
+		{
+			POWERDLOG(LOG_DEBUG, "activity %s of %s expired after %" G_GINT64_FORMAT "ms without activityEnd",
+			          activity->id, activity->client, now_ms - activity->start_ms);
+			activities.expired++;
+			activities_remove(activity);
+			continue;
+		}
+
+		activities_refresh(activity, now_ms);
+		activities_check_long_held(activity, now_ms);
+		activities_update_due(activity);
+	}
+
+	activities_arm();
+	return FALSE;
+}
+
+static void
+activities_arm(void)
+{
+	gint64 due_ms, now_ms;
+
+	if (!activities.heap->len)
+	{
+		if (activities.timer)
+			g_source_remove(activities.timer);
+		activities.timer = 0;
+		return;
+	}
+
+	due_ms = HEAP_AT(0)->due_ms;
+	if (activities.timer && activities.timer_due_ms == due_ms)
+		return;
+
+	if (activities.timer)
+		g_source_remove(activities.timer);
+
+	now_ms = activities_now_ms();
+	activities.timer_due_ms = due_ms;
+	activities.timer = g_timeout_add(due_ms > now_ms ? due_ms - now_ms : 0,
+	                                 activities_timeout, NULL);
+}
+
+/**
+ * @brief Record an activityStart.
+ *
+ * @retval true if the call has to be forwarded to sleepd with activities_forward() for
+ * *deadline_ms, false if it doesn't change anything for sleepd and can be answered locally.
+ */
+bool
+activities_start(const char *id, long duration_ms, const char *client, gint64 *deadline)
+{
+	gint64 now_ms = activities_now_ms();
+	gint64 deadline_ms = now_ms + duration_ms;
+	Activity *activity = g_hash_table_lookup(activities.table, id);
+	bool forward;
+
+	if (!activity)
+	{
+		activity = g_new0(Activity, 1);
+		activity->id = g_strdup(id);
+		activity->client = g_strdup(client ? client : "unknown");
+		activity->start_ms = now_ms;
+		g_hash_table_insert(activities.table, activity->id, activity);
+		activities_heap_push(activity);
+		activities.started++;
+		forward = true;
+	}
+	else
+	{
+		activity->renewals++;
+		activities.renewals++;
+		forward = deadline_ms < activity->forwarded_ms ||
+		          activity->forwarded_ms - now_ms < gChargeConfig.activity_renew_slack_ms;
+		if (!forward)
+			activities.renewals_skipped++;
+	}
+
+	activity->duration_ms = duration_ms;
+	activity->deadline_ms = deadline_ms;
+	*deadline = deadline_ms;
+
+	activities_check_long_held(activity, now_ms);
+	activities_update_due(activity);
+	activities_arm();
+	return forward;
+}
+
+/**
+ * @brief Record an activityEnd.
+ */
+void
+activities_end(const char *id)
+{
+	Activity *activity = g_hash_table_lookup(activities.table, id);
+
+	if (!activity)
+		return;
+
+	activities.ended++;
+	activities_remove(activity);
+	activities_arm();
+}
+
+bool
+activityQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	gint64 now_ms = activities_now_ms();
+	GString *buffer = g_string_sized_new(512);
+	guint i;
+
+	g_string_append_printf(buffer, "{\"returnValue\":true,\"started\":%u,\"ended\":%u,"
+	                       "\"expired\":%u,\"renewals\":%u,\"renewals_skipped\":%u,"
+	                       "\"refreshes\":%u,\"rejected\":%u,\"activities\":[",
+	                       activities.started, activities.ended, activities.expired,
+	                       activities.renewals, activities.renewals_skipped, activities.refreshes,
+	                       activities.rejected);
+
+	for (i = 0; i < activities.heap->len; i++)
+	{
+		Activity *activity = HEAP_AT(i);
+
+		g_string_append_printf(buffer, "%s{\"id\":\"%s\",\"client\":\"%s\",\"held_ms\":%"
+		                       G_GINT64_FORMAT ",\"duration_ms\":%ld,\"remaining_ms\":%"
+		                       G_GINT64_FORMAT ",\"renewals\":%u,"
+		                       "\"forwarded\":%u,\"long_held\":%s}",
+		                       i ? "," : "", activity->id, activity->client,
+		                       now_ms - activity->start_ms, activity->duration_ms,
+		                       MAX(activity->deadline_ms - now_ms, (gint64)0), activity->renewals,
+		                       activity->forwarded, activity->long_held ? "true" : "false");
+	}
+	g_string_append(buffer, "]}");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
+
+static int
+ActivitiesInit(void)
+{
+	activities.table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, activities_free);
+	activities.heap = g_ptr_array_new();
+	return 0;
+}
+
+INIT_FUNC(INIT_FUNC_FIRST, ActivitiesInit);
@@ -0,0 +1,33 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _ACTIVITIES_H_
+#define _ACTIVITIES_H_
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+bool activities_start(const char *id, long duration_ms, const char *client, gint64 *deadline_ms);
+void activities_forward(LSMessage *message, const char *id, gint64 deadline_ms, const char *payload);
+void activities_end(const char *id);
+
+bool activityQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _ACTIVITIES_H_
@@ -17,6 +17,9 @@
 * LICENSE@@@ */
 
 
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 /** 
  * @brief If from batterycheck, the reason why we woke up.
@@ -40,3 +43,23 @@ typedef int PowerEvent;
 void ScheduleIdleCheck(int interval_ms, bool fromPoll);
 void TriggerSuspend(const char *cause, PowerEvent power_event);
 
+
+/**
+ * @brief A power client, as registered through powerd (see suspend_ipc.c).
+ */
+typedef struct {
+    char   *client_id;
+    char   *name;
+    char   *token;              /* unique token of the identify subscription, NULL if none */
+    LSMessageToken watch;       /* server status watch on the sender, 0 if none */
+    bool    suspend_request;    /* registered for suspendRequest */
+    bool    prepare_suspend;    /* registered for prepareSuspend */
+    time_t  registered_at;
+    guint   messages;
+    guint   acks;
+    guint   nacks;
+} PowerClient;
+
+const PowerClient *PowerClientLookup(const char *client_id);
+
+bool clientRegistryQuery(LSHandle *sh, LSMessage *message, void *user_data);
@@ -30,6 +30,9 @@
 * luna://com.palm.sleep/com/palm/power/identify {...}. Similarly com.palm.power/com/palm/power/identify sends the
 * response from com.palm.sleep/com/palm/power/identify back to the original caller.
 *
+* The suspendRequest / prepareSuspend registrations and acks are the exception: they are collected
+* locally by suspend_votes.c, which sends sleepd a single verdict per phase.
+*
 */
 
 #ifdef USE_DBUS
@@ -46,6 +49,9 @@
 #include "suspend.h"
 #include "logging.h"
 #include "lunaservice_utils.h"
+#include "subscription.h"
+#include "suspend_votes.h"
+#include "activities.h"
 #include "init.h"
 
 #define LOG_DOMAIN "POWERD-SUSPEND: "
@@ -92,6 +98,175 @@ suspend_ipc_method_cb(LSHandle *sh, LSMessage *message, void *ctx)
     return true;
 }
 
+/**
+ * @brief Registry of the power clients.
+ *
+ * Clients are added when sleepd answers their subscribed identify, or when they register for
+ * a suspend vote, and removed when their identify subscription is cancelled. Clients that
+ * identified with sleepd directly have no such subscription: their service is watched on the bus
+ * from their first registration on, and they are removed when it goes away.
+ */
+static struct {
+	GHashTable *by_id;	/* clientId -> PowerClient */
+	GHashTable *by_token;	/* unique token of the identify message -> PowerClient */
+} power_clients;
+
+static void
+power_client_free(gpointer data)
+{
+	PowerClient *client = data;
+
+	if (client->watch)
+		LSCallCancel(GetLunaServiceHandle(), client->watch, NULL);
+	g_free(client->client_id);
+	g_free(client->name);
+	g_free(client->token);
+	g_free(client);
+}
+
+static PowerClient *
+power_client_get(const char *client_id)
+{
+	PowerClient *client = g_hash_table_lookup(power_clients.by_id, client_id);
+
+	if (!client)
+	{
+		client = g_new0(PowerClient, 1);
+		client->client_id = g_strdup(client_id);
+		client->registered_at = time(NULL);
+		g_hash_table_insert(power_clients.by_id, client->client_id, client);
+	}
+	return client;
+}
+
+static void
+power_client_remove(PowerClient *client)
+{
+	suspend_votes_client_remove(client->client_id);
+
+	if (client->token)
+		g_hash_table_remove(power_clients.by_token, client->token);
+	g_hash_table_remove(power_clients.by_id, client->client_id);
+}
+
+/**
+ * @brief Server status of the service of a client that identified with sleepd directly.
+ */
+static bool
+power_client_status_cb(LSHandle *sh, LSMessage *message, void *ctx)
+{
+	PowerClient *client = ctx;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	bool connected = json_object_get_boolean(json_object_object_get(object, "connected"));
+	json_object_put(object);
+
+	if (!connected)
+	{
+		POWERDLOG(LOG_INFO, "%s: client %s left the bus, dropping its suspend votes", __FUNCTION__,
+		          client->client_id);
+		power_client_remove(client);
+	}
+	return true;
+}
+
+/**
+ * @brief Make sure that powerd notices when the client registering with message goes away: either
+ * it identified through powerd, or its service is watched from now on.
+ *
+ * @retval false if the client can't be watched (an anonymous sender that didn't identify
+ * through powerd), its registration must then be refused.
+ */
+static bool
+power_client_watch(const char *client_id, LSMessage *message)
+{
+	PowerClient *client = g_hash_table_lookup(power_clients.by_id, client_id);
+
+	if (client && (client->token || client->watch))
+		return true;
+
+	const char *service = LSMessageGetSenderServiceName(message);
+	if (!service)
+	{
+		POWERDLOG(LOG_WARNING, "%s: %s registered without identifying through powerd from an "
+		          "anonymous sender, refused", __FUNCTION__, client_id);
+		return false;
+	}
+
+	client = power_client_get(client_id);
+
+	char *payload = g_strdup_printf("{\"serviceName\":\"%s\"}", service);
+	LSError lserror;
+	LSErrorInit(&lserror);
+	bool retVal = LSCall(GetLunaServiceHandle(), "luna://com.palm.lunabus/signal/registerServerStatus",
+	                     payload, power_client_status_cb, client, &client->watch, &lserror);
+	g_free(payload);
+
+	if (!retVal)
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+		client->watch = 0;
+		g_hash_table_remove(power_clients.by_id, client_id);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Look up a registered power client by clientId, NULL if unknown.
+ */
+const PowerClient *
+PowerClientLookup(const char *client_id)
+{
+	return g_hash_table_lookup(power_clients.by_id, client_id);
+}
+
+/**
+ * @brief Reply from sleepd to identify: add the subscribed client to the registry, so that
+ * its suspend votes can be dropped once it goes away.
+ */
+static bool
+suspend_ipc_identify_cb(LSHandle *sh, LSMessage *message, void *ctx)
+{
+	LSMessage *replyMessage = (LSMessage *)ctx;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (!is_error(object))
+	{
+		struct json_object *id = json_object_object_get(object, "clientId");
+		if (id && replyMessage && LSMessageIsSubscription(replyMessage))
+		{
+			PowerClient *client = power_client_get(json_object_get_string(id));
+
+			struct json_object *request = json_tokener_parse(LSMessageGetPayload(replyMessage));
+			if (!is_error(request))
+			{
+				struct json_object *name = json_object_object_get(request, "clientName");
+				if (name)
+				{
+					g_free(client->name);
+					client->name = g_strdup(json_object_get_string(name));
+				}
+				json_object_put(request);
+			}
+
+			if (client->token)
+				g_hash_table_remove(power_clients.by_token, client->token);
+			g_free(client->token);
+			client->token = g_strdup(LSMessageGetUniqueToken(replyMessage));
+			g_hash_table_insert(power_clients.by_token, client->token, client);
+			client->messages++;
+		}
+		json_object_put(object);
+	}
+
+	return suspend_ipc_method_cb(sh, message, ctx);
+}
+
 /**
  * @brief Unregister a client from suspend ipc calls.
  * This call is different from other redirected calls, since it forwards the request to "clientCancelByName"
@@ -104,17 +279,95 @@ suspend_ipc_method_cb(LSHandle *sh, LSMessage *message, void *ctx)
 static bool
 clientCancel(LSHandle *sh, LSMessage *message, void *ctx)
 {
+	/* batteryStatusQuery / chargerStatusQuery subscriptions are handled locally. */
+	if (SubscriptionCancel(message))
+		return true;
+
+	PowerClient *client = g_hash_table_lookup(power_clients.by_token, LSMessageGetUniqueToken(message));
+	if (client)
+		power_client_remove(client);
+
 	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"clientCancelByName",
 	               LSMessageGetPayload(message), NULL,(void *)message, NULL, NULL);
 	return true;
 }
 
+static void
+power_client_append(gpointer key, gpointer value, gpointer data)
+{
+	PowerClient *client = value;
+	GString *buffer = data;
+
+	if (buffer->str[buffer->len - 1] != '[')
+		g_string_append_c(buffer, ',');
+
+	g_string_append_printf(buffer, "{\"clientId\":\"%s\",\"name\":\"%s\",\"subscribed\":%s,"
+	                       "\"suspendRequest\":%s,\"prepareSuspend\":%s,\"registered_at\":%ld,"
+	                       "\"messages\":%u,\"acks\":%u,\"nacks\":%u}",
+	                       client->client_id, client->name ? client->name : "",
+	                       client->token ? "true" : "false",
+	                       client->suspend_request ? "true" : "false",
+	                       client->prepare_suspend ? "true" : "false",
+	                       (long)client->registered_at, client->messages, client->acks, client->nacks);
+}
+
+/**
+ * @brief Dump the power client registry.
+ */
+bool
+clientRegistryQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	GString *buffer = g_string_sized_new(512);
+
+	g_string_append_printf(buffer, "{\"returnValue\":true,\"count\":%u,\"clients\":[",
+	                       g_hash_table_size(power_clients.by_id));
+	g_hash_table_foreach(power_clients.by_id, power_client_append, buffer);
+	g_string_append(buffer, "]}");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
+
 /**
  * @brief Start an activity.
+ *
+ * Renewals that leave sleepd's decision unchanged are answered locally, see activities.c.
  */
 bool
 activityStartCallback(LSHandle *sh, LSMessage *message, void *user_data)
 {
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (!is_error(object))
+	{
+		struct json_object *id = json_object_object_get(object, "id");
+		struct json_object *duration = json_object_object_get(object, "duration_ms");
+
+		if (id && duration)
+		{
+			const char *client = LSMessageGetSenderServiceName(message);
+			gint64 deadline_ms;
+
+			if (activities_start(json_object_get_string(id), json_object_get_int(duration),
+			                     client ? client : LSMessageGetSender(message), &deadline_ms))
+				activities_forward(message, json_object_get_string(id), deadline_ms,
+				                   LSMessageGetPayload(message));
+			else
+				LSMessageReplySuccess(sh, message);
+
+			json_object_put(object);
+			return true;
+		}
+		json_object_put(object);
+	}
+
 	LSMessageRef(message);
 	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"activityStart",
 	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
@@ -128,6 +381,15 @@ activityStartCallback(LSHandle *sh, LSMessage *message, void *user_data)
 bool
 activityEndCallback(LSHandle *sh, LSMessage *message, void *user_data)
 {
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (!is_error(object))
+	{
+		struct json_object *id = json_object_object_get(object, "id");
+		if (id)
+			activities_end(json_object_get_string(id));
+		json_object_put(object);
+	}
+
 	LSMessageRef(message);
 	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"activityEnd",
 	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
@@ -143,7 +405,7 @@ identifyCallback(LSHandle *sh, LSMessage *message, void *data)
 {
 	LSMessageRef(message);
 	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"identify",
-	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
+	               LSMessageGetPayload(message), suspend_ipc_identify_cb,(void *)message, NULL, NULL);
 
 	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
 	if ( is_error(object) ) {
@@ -187,16 +449,91 @@ TESTSuspendCallback(LSHandle *sh, LSMessage *message, void *user_data)
 }
 
 
+/**
+ * @brief Account a suspend vote registration or ack in the client registry.
+ */
+static void
+suspend_ipc_client_vote(const char *client_id, SuspendPhase phase, bool is_ack, bool flag)
+{
+	PowerClient *client = (PowerClient *)PowerClientLookup(client_id);
+
+	if (!client)
+	{
+		/* Clients that identified with sleepd directly are only known once they register */
+		if (is_ack || !flag)
+			return;
+		client = power_client_get(client_id);
+	}
+
+	client->messages++;
+
+	if (is_ack)
+	{
+		if (flag)
+			client->acks++;
+		else
+			client->nacks++;
+		return;
+	}
+
+	if (phase == kSuspendPhaseRequest)
+		client->suspend_request = flag;
+	else
+		client->prepare_suspend = flag;
+
+	if (!client->token && !client->suspend_request && !client->prepare_suspend)
+		g_hash_table_remove(power_clients.by_id, client_id);
+}
+
+/**
+ * @brief Handle a suspend vote registration or ack of a client: {"clientId":..., key:bool}.
+ */
+static bool
+suspend_ipc_vote(LSHandle *sh, LSMessage *message, SuspendPhase phase, bool is_ack)
+{
+	const char *key = is_ack ? "ack" : "register";
+	bool retVal = false;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+	{
+		LSMessageReplyErrorBadJSON(sh, message);
+		return true;
+	}
+
+	struct json_object *id = json_object_object_get(object, "clientId");
+	struct json_object *value = json_object_object_get(object, key);
+
+	if (id && value)
+	{
+		const char *client_id = json_object_get_string(id);
+		bool flag = json_object_get_boolean(value);
+
+		if (is_ack)
+			retVal = suspend_votes_ack(client_id, phase, flag);
+		else if (!flag || power_client_watch(client_id, message))
+			retVal = suspend_votes_register(client_id, phase, flag);
+
+		if (retVal)
+			suspend_ipc_client_vote(client_id, phase, is_ack, flag);
+	}
+
+	if (retVal)
+		LSMessageReplySuccess(sh, message);
+	else
+		LSMessageReplyErrorInvalidParams(sh, message);
+
+	json_object_put(object);
+	return true;
+}
+
 /**
  * @brief Register for "suspendRequest" notifications.
  */
 bool
 suspendRequestRegister(LSHandle *sh, LSMessage *message, void *data)
 {
-	LSMessageRef(message);
-	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"suspendRequestRegister",
-	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
-	return true;
+	return suspend_ipc_vote(sh, message, kSuspendPhaseRequest, false);
 }
 
 /**
@@ -205,10 +542,7 @@ suspendRequestRegister(LSHandle *sh, LSMessage *message, void *data)
 bool
 suspendRequestAck(LSHandle *sh, LSMessage *message, void *data)
 {
-	LSMessageRef(message);
-	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"suspendRequestAck",
-	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
-	return true;
+	return suspend_ipc_vote(sh, message, kSuspendPhaseRequest, true);
 }
 
 /**
@@ -218,10 +552,7 @@ suspendRequestAck(LSHandle *sh, LSMessage *message, void *data)
 bool
 prepareSuspendRegister(LSHandle *sh, LSMessage *message, void *data)
 {
-	LSMessageRef(message);
-	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"prepareSuspendRegister",
-	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
-	return true;
+	return suspend_ipc_vote(sh, message, kSuspendPhasePrepare, false);
 }
 
 /**
@@ -231,10 +562,7 @@ prepareSuspendRegister(LSHandle *sh, LSMessage *message, void *data)
 bool
 prepareSuspendAck(LSHandle *sh, LSMessage *message, void *data)
 {
-	LSMessageRef(message);
-	LSCallOneReply(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"prepareSuspendAck",
-	               LSMessageGetPayload(message), suspend_ipc_method_cb,(void *)message, NULL, NULL);
-	return true;
+	return suspend_ipc_vote(sh, message, kSuspendPhasePrepare, true);
 }
 
 /** 
@@ -259,6 +587,9 @@ SuspendIPCInit(void)
     LSError lserror;
     LSErrorInit(&lserror);
 
+    power_clients.by_id = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, power_client_free);
+    power_clients.by_token = g_hash_table_new(g_str_hash, g_str_equal);
+
     retVal = LSSubscriptionSetCancelFunction(GetLunaServiceHandle(),
         clientCancel, NULL, &lserror);
     if (!retVal)
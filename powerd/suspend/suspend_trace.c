@@ -0,0 +1,483 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file suspend_trace.c
+ *
+ * @brief Suspend cycle tracing.
+ *
+ * Every suspend attempt is traced as a cycle: the suspendRequest round, its verdict, the
+ * prepareSuspend round, its verdict, the "suspended" signal and the "resume" signal. Times are
+ * kept in ms of monotonic time since the start of the cycle; the time spent suspended, during
+ * which the monotonic clock stops, comes from the RTC. The ack latency of every client, from the
+ * start of the round to its ack, goes to a log2 histogram per client.
+ *
+ * Clients that missed their ack deadline are counted and logged as well.
+ *
+ * The last SUSPEND_TRACE_CYCLES cycles, the aggregates and the client histograms are served by
+ * luna://com.palm.power/com/palm/power/suspendStats.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "clock.h"
+#include "init.h"
+#include "logging.h"
+#include "suspend_trace.h"
+
+#define LOG_DOMAIN "SUSPEND-TRACE: "
+
+#define SUSPEND_TRACE_CYCLES		16
+
+/* @brief Bucket 0 counts acks under 1ms, bucket i acks under 2^i ms, the last one the rest. */
+#define SUSPEND_TRACE_BUCKETS		16
+
+/* @brief Ack timeouts remembered. */
+#define SUSPEND_TRACE_TIMEOUTS		16
+
+/* @brief Clients beyond this many are not given a histogram. */
+#define SUSPEND_TRACE_MAX_CLIENTS	128
+
+typedef enum {
+	kSuspendEventRequest,
+	kSuspendEventRequestDecided,
+	kSuspendEventPrepare,
+	kSuspendEventPrepareDecided,
+	kSuspendEventSuspended,
+	kSuspendEventResume,
+	kSuspendEventLast,
+} SuspendEvent;
+
+static const char *suspend_event_names[kSuspendEventLast] = {
+	"request_ms",
+	"request_decided_ms",
+	"prepare_ms",
+	"prepare_decided_ms",
+	"suspended_ms",
+	"resume_ms",
+};
+
+typedef enum {
+	kSuspendOutcomeOpen,
+	kSuspendOutcomeResumed,
+	kSuspendOutcomeNack,
+	kSuspendOutcomeAbandoned,	/* superseded by a new cycle before it resumed */
+} SuspendOutcome;
+
+static const char *suspend_outcome_names[] = {
+	"open",
+	"resumed",
+	"nack",
+	"abandoned",
+};
+
+typedef struct {
+	guint           id;
+	SuspendOutcome  outcome;
+	struct timespec start;
+	long            event_ms[kSuspendEventLast];	/* -1 if not reached */
+	long            slept_ms;			/* RTC time suspended, -1 if unknown */
+	struct timespec suspend_rtc;
+
+	char            blocker[64];			/* client that NACKed */
+	char            slowest[kSuspendPhaseLast][64];	/* last client to ack in each phase */
+	long            slowest_ms[kSuspendPhaseLast];
+	guint           timeouts;
+} SuspendCycle;
+
+typedef struct {
+	char         client_id[64];
+	SuspendPhase phase;
+	guint        cycle;
+	time_t       when;	/* RTC seconds */
+} SuspendTimeout;
+
+typedef struct {
+	guint   acks;
+	guint   nacks;
+	guint   timeouts;
+	long    total_ms;
+	long    max_ms;
+	guint   histogram[SUSPEND_TRACE_BUCKETS];
+} SuspendClientStats;
+
+static struct {
+	SuspendCycle    cycles[SUSPEND_TRACE_CYCLES];
+	guint           head;		/* next slot to write */
+	guint           count;
+	SuspendCycle   *current;	/* open cycle, NULL if none */
+	struct timespec phase_start[kSuspendPhaseLast];
+
+	guint           total;
+	guint           outcomes[G_N_ELEMENTS(suspend_outcome_names)];
+	long            entry_total_ms;	/* request to suspended, resumed cycles */
+	long            entry_max_ms;
+	long            slept_total_ms;
+
+	GHashTable     *clients;	/* clientId -> SuspendClientStats */
+
+	SuspendTimeout  timeouts[SUSPEND_TRACE_TIMEOUTS];
+	guint           timeouts_head;
+	guint           timeouts_count;
+} suspend_trace;
+
+static long
+suspend_trace_ms_since(struct timespec *since)
+{
+	struct timespec now, elapsed;
+
+	ClockGetTime(&now);
+	ClockDiff(&elapsed, &now, since);
+	return ClockGetMs(&elapsed);
+}
+
+static void
+suspend_trace_close(SuspendOutcome outcome)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+
+	if (!cycle)
+		return;
+
+	cycle->outcome = outcome;
+	suspend_trace.outcomes[outcome]++;
+	suspend_trace.current = NULL;
+
+	if (outcome == kSuspendOutcomeResumed && cycle->event_ms[kSuspendEventSuspended] >= 0)
+	{
+		long entry_ms = cycle->event_ms[kSuspendEventSuspended];
+
+		suspend_trace.entry_total_ms += entry_ms;
+		suspend_trace.entry_max_ms = MAX(suspend_trace.entry_max_ms, entry_ms);
+		if (cycle->slept_ms > 0)
+			suspend_trace.slept_total_ms += cycle->slept_ms;
+	}
+
+	POWERDLOG(LOG_INFO, "cycle %u %s: request acked %ldms, prepare acked %ldms, suspended %ldms, "
+	          "slept %ldms%s%s",
+	          cycle->id, suspend_outcome_names[outcome],
+	          cycle->event_ms[kSuspendEventRequestDecided],
+	          cycle->event_ms[kSuspendEventPrepareDecided],
+	          cycle->event_ms[kSuspendEventSuspended],
+	          cycle->slept_ms,
+	          *cycle->blocker ? ", blocked by " : "", cycle->blocker);
+}
+
+static SuspendCycle *
+suspend_trace_open(void)
+{
+	SuspendCycle *cycle = &suspend_trace.cycles[suspend_trace.head];
+	int i;
+
+	suspend_trace_close(kSuspendOutcomeAbandoned);
+
+	memset(cycle, 0, sizeof(*cycle));
+	cycle->id = ++suspend_trace.total;
+	cycle->outcome = kSuspendOutcomeOpen;
+	cycle->slept_ms = -1;
+	ClockGetTime(&cycle->start);
+	for (i = 0; i < kSuspendEventLast; i++)
+		cycle->event_ms[i] = -1;
+	for (i = 0; i < kSuspendPhaseLast; i++)
+		cycle->slowest_ms[i] = -1;
+
+	suspend_trace.head = (suspend_trace.head + 1) % SUSPEND_TRACE_CYCLES;
+	if (suspend_trace.count < SUSPEND_TRACE_CYCLES)
+		suspend_trace.count++;
+
+	suspend_trace.current = cycle;
+	return cycle;
+}
+
+static void
+suspend_trace_event(SuspendEvent event)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+
+	if (cycle && cycle->event_ms[event] < 0)
+		cycle->event_ms[event] = suspend_trace_ms_since(&cycle->start);
+}
+
+/**
+ * @brief A suspendRequest or prepareSuspend round started.
+ */
+void
+suspend_trace_phase_start(SuspendPhase phase)
+{
+	ClockGetTime(&suspend_trace.phase_start[phase]);
+
+	/* A cycle starts with suspendRequest, or with prepareSuspend when sleepd skipped it. */
+	if (phase == kSuspendPhaseRequest || !suspend_trace.current)
+		suspend_trace_open();
+
+	suspend_trace_event(phase == kSuspendPhaseRequest ? kSuspendEventRequest : kSuspendEventPrepare);
+}
+
+static guint
+suspend_trace_bucket(long ms)
+{
+	guint bucket = 0;
+
+	while (ms > 0 && bucket < SUSPEND_TRACE_BUCKETS - 1)
+	{
+		ms >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static SuspendClientStats *
+suspend_trace_client(const char *client_id)
+{
+	SuspendClientStats *stats = g_hash_table_lookup(suspend_trace.clients, client_id);
+
+	if (!stats && g_hash_table_size(suspend_trace.clients) < SUSPEND_TRACE_MAX_CLIENTS)
+	{
+		stats = g_new0(SuspendClientStats, 1);
+		g_hash_table_insert(suspend_trace.clients, g_strdup(client_id), stats);
+	}
+	return stats;
+}
+
+/**
+ * @brief A client voted in the current round of the phase.
+ */
+void
+suspend_trace_ack(const char *client_id, SuspendPhase phase, bool ack)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+	long ms = suspend_trace_ms_since(&suspend_trace.phase_start[phase]);
+
+	SuspendClientStats *stats = suspend_trace_client(client_id);
+
+	if (stats)
+	{
+		if (ack)
+			stats->acks++;
+		else
+			stats->nacks++;
+		stats->total_ms += ms;
+		stats->max_ms = MAX(stats->max_ms, ms);
+		stats->histogram[suspend_trace_bucket(ms)]++;
+	}
+
+	if (cycle && ms >= cycle->slowest_ms[phase])
+	{
+		cycle->slowest_ms[phase] = ms;
+		g_strlcpy(cycle->slowest[phase], client_id, sizeof(cycle->slowest[phase]));
+	}
+}
+
+/**
+ * @brief A client missed its ack deadline in the current round of the phase.
+ */
+void
+suspend_trace_timeout(const char *client_id, SuspendPhase phase)
+{
+	SuspendTimeout *timeout = &suspend_trace.timeouts[suspend_trace.timeouts_head];
+	SuspendClientStats *stats = suspend_trace_client(client_id);
+
+	if (stats)
+		stats->timeouts++;
+	if (suspend_trace.current)
+		suspend_trace.current->timeouts++;
+
+	g_strlcpy(timeout->client_id, client_id, sizeof(timeout->client_id));
+	timeout->phase = phase;
+	timeout->cycle = suspend_trace.current ? suspend_trace.current->id : 0;
+	timeout->when = time(NULL);
+
+	suspend_trace.timeouts_head = (suspend_trace.timeouts_head + 1) % SUSPEND_TRACE_TIMEOUTS;
+	if (suspend_trace.timeouts_count < SUSPEND_TRACE_TIMEOUTS)
+		suspend_trace.timeouts_count++;
+}
+
+/**
+ * @brief The round of the phase was decided, client_id is the client that NACKed if any.
+ */
+void
+suspend_trace_verdict(SuspendPhase phase, bool ack, const char *client_id)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+
+	suspend_trace_event(phase == kSuspendPhaseRequest ?
+	                    kSuspendEventRequestDecided : kSuspendEventPrepareDecided);
+
+	if (cycle && !ack)
+	{
+		g_strlcpy(cycle->blocker, client_id ? client_id : "", sizeof(cycle->blocker));
+		suspend_trace_close(kSuspendOutcomeNack);
+	}
+}
+
+/**
+ * @brief The device is about to suspend.
+ */
+void
+suspend_trace_suspended(struct timespec *monotonic, struct timespec *rtc)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+	struct timespec elapsed;
+
+	if (!cycle)
+		cycle = suspend_trace_open();
+
+	ClockDiff(&elapsed, monotonic, &cycle->start);
+	cycle->event_ms[kSuspendEventSuspended] = ClockGetMs(&elapsed);
+	cycle->suspend_rtc = *rtc;
+}
+
+/**
+ * @brief The device resumed.
+ */
+void
+suspend_trace_resumed(struct timespec *monotonic, struct timespec *rtc)
+{
+	SuspendCycle *cycle = suspend_trace.current;
+	struct timespec elapsed;
+
+	if (!cycle)
+		return;
+
+	ClockDiff(&elapsed, monotonic, &cycle->start);
+	cycle->event_ms[kSuspendEventResume] = ClockGetMs(&elapsed);
+
+	if (cycle->event_ms[kSuspendEventSuspended] >= 0)
+	{
+		ClockDiff(&elapsed, rtc, &cycle->suspend_rtc);
+		cycle->slept_ms = ClockGetMs(&elapsed);
+	}
+
+	suspend_trace_close(kSuspendOutcomeResumed);
+}
+
+static void
+suspend_trace_cycle_append(GString *buffer, SuspendCycle *cycle)
+{
+	int i;
+
+	g_string_append_printf(buffer, "{\"id\":%u,\"outcome\":\"%s\"", cycle->id,
+	                       suspend_outcome_names[cycle->outcome]);
+	for (i = 0; i < kSuspendEventLast; i++)
+	{
+		if (cycle->event_ms[i] >= 0)
+			g_string_append_printf(buffer, ",\"%s\":%ld", suspend_event_names[i], cycle->event_ms[i]);
+	}
+	if (cycle->slept_ms >= 0)
+		g_string_append_printf(buffer, ",\"slept_ms\":%ld", cycle->slept_ms);
+	if (*cycle->blocker)
+		g_string_append_printf(buffer, ",\"blocker\":\"%s\"", cycle->blocker);
+	if (cycle->timeouts)
+		g_string_append_printf(buffer, ",\"timeouts\":%u", cycle->timeouts);
+	if (cycle->slowest_ms[kSuspendPhaseRequest] >= 0)
+		g_string_append_printf(buffer, ",\"slowest_request\":{\"clientId\":\"%s\",\"ms\":%ld}",
+		                       cycle->slowest[kSuspendPhaseRequest],
+		                       cycle->slowest_ms[kSuspendPhaseRequest]);
+	if (cycle->slowest_ms[kSuspendPhasePrepare] >= 0)
+		g_string_append_printf(buffer, ",\"slowest_prepare\":{\"clientId\":\"%s\",\"ms\":%ld}",
+		                       cycle->slowest[kSuspendPhasePrepare],
+		                       cycle->slowest_ms[kSuspendPhasePrepare]);
+	g_string_append_c(buffer, '}');
+}
+
+static void
+suspend_trace_client_append(gpointer key, gpointer value, gpointer data)
+{
+	SuspendClientStats *stats = value;
+	GString *buffer = data;
+	guint votes = stats->acks + stats->nacks;
+	int i;
+
+	if (buffer->str[buffer->len - 1] != '[')
+		g_string_append_c(buffer, ',');
+
+	g_string_append_printf(buffer, "{\"clientId\":\"%s\",\"acks\":%u,\"nacks\":%u,\"timeouts\":%u,"
+	                       "\"avg_ms\":%ld,\"max_ms\":%ld,\"histogram\":[",
+	                       (char *)key, stats->acks, stats->nacks, stats->timeouts,
+	                       votes ? stats->total_ms / votes : 0, stats->max_ms);
+	for (i = 0; i < SUSPEND_TRACE_BUCKETS; i++)
+		g_string_append_printf(buffer, "%s%u", i ? "," : "", stats->histogram[i]);
+	g_string_append(buffer, "]}");
+}
+
+bool
+suspendStatsQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	GString *buffer = g_string_sized_new(1024);
+	guint resumed = suspend_trace.outcomes[kSuspendOutcomeResumed];
+	guint i;
+
+	g_string_append_printf(buffer, "{\"returnValue\":true,\"cycles\":%u,\"resumed\":%u,"
+	                       "\"nacked\":%u,\"abandoned\":%u,\"avg_entry_ms\":%ld,\"max_entry_ms\":%ld,"
+	                       "\"slept_ms\":%ld,\"histogram_bucket_ms\":\"2^i\",\"last\":[",
+	                       suspend_trace.total, resumed,
+	                       suspend_trace.outcomes[kSuspendOutcomeNack],
+	                       suspend_trace.outcomes[kSuspendOutcomeAbandoned],
+	                       resumed ? suspend_trace.entry_total_ms / resumed : 0,
+	                       suspend_trace.entry_max_ms, suspend_trace.slept_total_ms);
+
+	/* Newest first */
+	for (i = 0; i < suspend_trace.count; i++)
+	{
+		guint slot = (suspend_trace.head + SUSPEND_TRACE_CYCLES - 1 - i) % SUSPEND_TRACE_CYCLES;
+
+		if (i)
+			g_string_append_c(buffer, ',');
+		suspend_trace_cycle_append(buffer, &suspend_trace.cycles[slot]);
+	}
+
+	g_string_append(buffer, "],\"timeouts\":[");
+	for (i = 0; i < suspend_trace.timeouts_count; i++)
+	{
+		guint slot = (suspend_trace.timeouts_head + SUSPEND_TRACE_TIMEOUTS - 1 - i) %
+		             SUSPEND_TRACE_TIMEOUTS;
+		SuspendTimeout *timeout = &suspend_trace.timeouts[slot];
+
+		g_string_append_printf(buffer, "%s{\"clientId\":\"%s\",\"phase\":\"%s\",\"cycle\":%u,"
+		                       "\"time\":%ld}", i ? "," : "", timeout->client_id,
+		                       timeout->phase == kSuspendPhaseRequest ? "suspendRequest" : "prepareSuspend",
+		                       timeout->cycle, (long)timeout->when);
+	}
+
+	g_string_append(buffer, "],\"clients\":[");
+	g_hash_table_foreach(suspend_trace.clients, suspend_trace_client_append, buffer);
+	g_string_append(buffer, "]}");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
+
+static int
+SuspendTraceInit(void)
+{
+	suspend_trace.clients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	return 0;
+}
+
+INIT_FUNC(INIT_FUNC_FIRST, SuspendTraceInit);
@@ -0,0 +1,39 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _SUSPEND_TRACE_H_
+#define _SUSPEND_TRACE_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <luna-service2/lunaservice.h>
+
+#include "suspend_votes.h"
+
+void suspend_trace_phase_start(SuspendPhase phase);
+void suspend_trace_ack(const char *client_id, SuspendPhase phase, bool ack);
+void suspend_trace_timeout(const char *client_id, SuspendPhase phase);
+void suspend_trace_verdict(SuspendPhase phase, bool ack, const char *client_id);
+
+void suspend_trace_suspended(struct timespec *monotonic, struct timespec *rtc);
+void suspend_trace_resumed(struct timespec *monotonic, struct timespec *rtc);
+
+bool suspendStatsQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _SUSPEND_TRACE_H_
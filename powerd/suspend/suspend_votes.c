@@ -0,0 +1,546 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file suspend_votes.c
+ *
+ * @brief Local aggregation of the suspend votes.
+ *
+ * Instead of proxying every client registration and every suspendRequestAck / prepareSuspendAck to
+ * sleepd, powerd registers itself with sleepd as the only voter for both phases and collects the
+ * votes of its clients. When sleepd starts a phase (suspendRequest / prepareSuspend signal), a new
+ * round opens; it is decided, and the single verdict sent to sleepd, on the first NACK or as soon
+ * as every client registered for the phase has acked. When a round opens, every voter gets a
+ * deadline of suspend_request_ack_grace_ms / prepare_suspend_ack_grace_ms on a timer wheel; a
+ * client that hasn't answered by then is logged and counted as an ACK, so that it cannot hold
+ * off suspend until the sleepd timeout (a grace of 0 leaves it to sleepd).
+ *
+ * A vote arriving while no round is open is kept for the next round if it comes in shortly before
+ * it and cannot be a late vote for the round that just closed, and dropped otherwise.
+ *
+ * powerd (re)registers with sleepd whenever sleepd connects to the bus.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "main.h"
+#include "clock.h"
+#include "config.h"
+#include "init.h"
+#include "logging.h"
+#include "suspend_votes.h"
+#include "suspend_trace.h"
+#include "timerwheel.h"
+
+#define LOG_DOMAIN "SUSPEND-VOTES: "
+
+#define SLEEPD_SUSPEND_SERVICE "luna://com.palm.sleep/com/palm/power/"
+
+#define SUSPEND_VOTES_CLIENT_NAME "com.palm.power"
+
+/* Ack deadlines are kept on a timer wheel of 64 slots of 100ms */
+#define SUSPEND_VOTES_TICK_MS		100
+#define SUSPEND_VOTES_WHEEL_SLOTS	64
+
+/*
+ * Clients get the signal at the same time as powerd, so their ack can come in before powerd
+ * opened the round. Votes that early are kept for this long and applied to the next round.
+ * Only votes that cannot belong to the round that just closed are kept, see suspend_votes_ack().
+ */
+#define SUSPEND_VOTES_EARLY_MS		1000
+
+typedef struct {
+	const char *signal;	/* sleepd signal opening a round */
+	const char *register_method;
+	const char *ack_method;
+
+	GHashTable *voters;	/* clientId -> clientId, registered for the phase */
+	GHashTable *acked;	/* clientId -> clientId, acked in the current round */
+	GHashTable *deadlines;	/* clientId -> SuspendVoteDeadline, yet to ack in the current round */
+	GHashTable *early;	/* clientId -> SuspendEarlyVote, voted before the round opened */
+	GHashTable *voted;	/* clientId -> clientId, voted in the current or last closed round */
+
+	guint       round;
+	bool        open;
+	bool        nacked;	/* the last closed round was decided by a NACK */
+	bool        registered;	/* powerd registered with sleepd for the phase */
+} SuspendVotePhase;
+
+static SuspendVotePhase suspend_votes[kSuspendPhaseLast] = {
+	[kSuspendPhaseRequest] = {
+		.signal = "suspendRequest",
+		.register_method = "suspendRequestRegister",
+		.ack_method = "suspendRequestAck",
+	},
+	[kSuspendPhasePrepare] = {
+		.signal = "prepareSuspend",
+		.register_method = "prepareSuspendRegister",
+		.ack_method = "prepareSuspendAck",
+	},
+};
+
+/* @brief clientId sleepd gave powerd, NULL while not registered. */
+static char *suspend_votes_client_id = NULL;
+
+typedef struct {
+	bool            ack;
+	struct timespec when;
+} SuspendEarlyVote;
+
+typedef struct {
+	SuspendPhase      phase;
+	char             *client_id;
+	GTimerWheelTimer *timer;
+} SuspendVoteDeadline;
+
+static GTimerWheel *suspend_votes_wheel = NULL;
+
+static void
+suspend_votes_deadline_free(gpointer data)
+{
+	SuspendVoteDeadline *deadline = data;
+
+	g_timer_wheel_cancel(suspend_votes_wheel, deadline->timer);
+	g_free(deadline->client_id);
+	g_free(deadline);
+}
+
+static int
+suspend_votes_grace_ms(SuspendPhase phase)
+{
+	return phase == kSuspendPhaseRequest ? gChargeConfig.suspend_request_ack_grace_ms :
+	                                       gChargeConfig.prepare_suspend_ack_grace_ms;
+}
+
+static void
+suspend_votes_verdict(SuspendPhase phase, bool ack, const char *cause)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+
+	votes->open = false;
+	votes->nacked = !ack;
+	g_hash_table_remove_all(votes->acked);
+	g_hash_table_remove_all(votes->deadlines);
+
+	POWERDLOG(LOG_INFO, "%s round %u: %s (%s)", votes->signal, votes->round,
+	          ack ? "ACK" : "NACK", cause);
+
+	if (!suspend_votes_client_id || !votes->registered)
+		return;
+
+	char *uri = g_strconcat(SLEEPD_SUSPEND_SERVICE, votes->ack_method, NULL);
+	char *payload = g_strdup_printf("{\"clientId\":\"%s\",\"ack\":%s}",
+	                                suspend_votes_client_id, ack ? "true" : "false");
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSCallOneReply(GetLunaServiceHandle(), uri, payload, NULL, NULL, NULL, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_free(payload);
+	g_free(uri);
+}
+
+static void
+suspend_votes_check(SuspendPhase phase)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+
+	if (votes->open && g_hash_table_size(votes->acked) >= g_hash_table_size(votes->voters))
+	{
+		suspend_trace_verdict(phase, true, NULL);
+		suspend_votes_verdict(phase, true, "all clients acked");
+	}
+}
+
+static void suspend_votes_deadline_expired(gpointer data);
+
+/**
+ * @brief Give every voter of the phase grace_ms to ack the round.
+ */
+static void
+suspend_votes_deadlines_start(SuspendPhase phase, int grace_ms)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, votes->voters);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		SuspendVoteDeadline *deadline = g_new0(SuspendVoteDeadline, 1);
+
+		deadline->phase = phase;
+		deadline->client_id = g_strdup(key);
+		deadline->timer = g_timer_wheel_add(suspend_votes_wheel, grace_ms,
+		                                    suspend_votes_deadline_expired, deadline);
+		g_hash_table_replace(votes->deadlines, deadline->client_id, deadline);
+	}
+}
+
+/**
+ * @brief A voter didn't ack within the grace period: log it and count it as an ack, so that
+ * it can't hold off suspend until sleepd's own timeout.
+ */
+static void
+suspend_votes_deadline_expired(gpointer data)
+{
+	SuspendVoteDeadline *deadline = data;
+	SuspendPhase phase = deadline->phase;
+	SuspendVotePhase *votes = &suspend_votes[phase];
+	char *id = g_hash_table_lookup(votes->voters, deadline->client_id);
+
+	deadline->timer = NULL;
+
+	POWERDLOG(LOG_WARNING, "%s round %u: %s did not ack within %dms, counted as ACK",
+	          votes->signal, votes->round, deadline->client_id, suspend_votes_grace_ms(phase));
+	suspend_trace_timeout(deadline->client_id, phase);
+
+	g_hash_table_remove(votes->deadlines, deadline->client_id);
+
+	if (id && votes->open)
+	{
+		g_hash_table_replace(votes->acked, id, id);
+		suspend_votes_check(phase);
+	}
+}
+
+static void suspend_votes_vote(SuspendPhase phase, char *id, bool ack);
+
+/**
+ * @brief Apply the votes that came in shortly before the round opened.
+ */
+static void
+suspend_votes_early_replay(SuspendPhase phase)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *ids = NULL, *acks = NULL, *i, *j;
+	struct timespec now, age;
+
+	ClockGetTime(&now);
+
+	g_hash_table_iter_init(&iter, votes->early);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		SuspendEarlyVote *early = value;
+
+		ClockDiff(&age, &now, &early->when);
+		if (ClockGetMs(&age) > SUSPEND_VOTES_EARLY_MS)
+			continue;
+
+		ids = g_slist_prepend(ids, key);
+		acks = g_slist_prepend(acks, GINT_TO_POINTER(early->ack));
+	}
+	g_hash_table_remove_all(votes->early);
+
+	/* A NACK decides the round, the remaining votes are moot */
+	for (i = ids, j = acks; i && votes->open; i = i->next, j = j->next)
+		suspend_votes_vote(phase, i->data, GPOINTER_TO_INT(j->data));
+
+	g_slist_free(ids);
+	g_slist_free(acks);
+}
+
+static void
+suspend_votes_round_start(SuspendPhase phase)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+	int grace_ms = suspend_votes_grace_ms(phase);
+
+	votes->round++;
+	votes->open = true;
+	votes->nacked = false;
+	g_hash_table_remove_all(votes->acked);
+	g_hash_table_remove_all(votes->deadlines);
+	g_hash_table_remove_all(votes->voted);
+
+	if (grace_ms > 0)
+		suspend_votes_deadlines_start(phase, grace_ms);
+
+	POWERDLOG(LOG_DEBUG, "%s round %u: %u voters", votes->signal, votes->round,
+	          g_hash_table_size(votes->voters));
+
+	suspend_trace_phase_start(phase);
+	suspend_votes_early_replay(phase);
+	suspend_votes_check(phase);
+}
+
+/**
+ * @brief Register (or unregister) a client as a voter for the phase.
+ */
+bool
+suspend_votes_register(const char *client_id, SuspendPhase phase, bool reg)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+
+	if (reg)
+	{
+		/* acked and deadlines share the key of voters, keep it if already registered */
+		if (!g_hash_table_lookup(votes->voters, client_id))
+		{
+			char *id = g_strdup(client_id);
+			g_hash_table_insert(votes->voters, id, id);
+		}
+	}
+	else
+	{
+		g_hash_table_remove(votes->deadlines, client_id);
+		g_hash_table_remove(votes->early, client_id);
+		g_hash_table_remove(votes->voted, client_id);
+		g_hash_table_remove(votes->acked, client_id);
+		g_hash_table_remove(votes->voters, client_id);
+		suspend_votes_check(phase);
+	}
+	return true;
+}
+
+/**
+ * @brief Record the vote of a client in the current round of the phase.
+ *
+ * A vote while no round is open is either early for the next round or late for the last one,
+ * and the protocol doesn't say which. It is only kept for the next round if it can't be late:
+ * the last round wasn't cut short by a NACK (after which any vote may still be for it), and the
+ * client didn't already vote in it. Everything else is dropped.
+ *
+ * @retval false if the client isn't registered for the phase.
+ */
+bool
+suspend_votes_ack(const char *client_id, SuspendPhase phase, bool ack)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+	char *id = g_hash_table_lookup(votes->voters, client_id);
+
+	if (!id)
+		return false;
+
+	if (!votes->open)
+	{
+		if (votes->round && (votes->nacked || g_hash_table_lookup(votes->voted, id)))
+		{
+			POWERDLOG(LOG_DEBUG, "%s from %s after round %u closed, dropped",
+			          votes->ack_method, client_id, votes->round);
+			return true;
+		}
+
+		SuspendEarlyVote *early = g_new0(SuspendEarlyVote, 1);
+
+		POWERDLOG(LOG_DEBUG, "%s from %s before the round opened, kept for the next round",
+		          votes->ack_method, client_id);
+		early->ack = ack;
+		ClockGetTime(&early->when);
+		g_hash_table_replace(votes->early, id, early);
+		return true;
+	}
+
+	suspend_votes_vote(phase, id, ack);
+	return true;
+}
+
+/**
+ * @brief Count the vote of voter id in the open round of the phase.
+ */
+static void
+suspend_votes_vote(SuspendPhase phase, char *id, bool ack)
+{
+	SuspendVotePhase *votes = &suspend_votes[phase];
+
+	suspend_trace_ack(id, phase, ack);
+	g_hash_table_remove(votes->deadlines, id);
+	g_hash_table_replace(votes->voted, id, id);
+
+	if (!ack)
+	{
+		suspend_trace_verdict(phase, false, id);
+
+		char *cause = g_strdup_printf("NACK from %s", id);
+		suspend_votes_verdict(phase, false, cause);
+		g_free(cause);
+		return;
+	}
+
+	g_hash_table_replace(votes->acked, id, id);
+	suspend_votes_check(phase);
+}
+
+/**
+ * @brief Forget a client that went away, in every phase.
+ */
+void
+suspend_votes_client_remove(const char *client_id)
+{
+	int phase;
+
+	for (phase = 0; phase < kSuspendPhaseLast; phase++)
+		suspend_votes_register(client_id, phase, false);
+}
+
+static bool
+suspend_votes_signal(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	SuspendPhase phase = GPOINTER_TO_INT(user_data);
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	bool registration = json_object_get_boolean(json_object_object_get(object, "returnValue"));
+	json_object_put(object);
+
+	if (!registration)
+		suspend_votes_round_start(phase);
+	return true;
+}
+
+static bool
+suspend_votes_register_cb(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	SuspendPhase phase = GPOINTER_TO_INT(user_data);
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	suspend_votes[phase].registered =
+		json_object_get_boolean(json_object_object_get(object, "returnValue"));
+	json_object_put(object);
+
+	if (!suspend_votes[phase].registered)
+		POWERDLOG(LOG_ERR, "Could not register for %s with sleepd", suspend_votes[phase].signal);
+	return true;
+}
+
+static bool
+suspend_votes_identify_cb(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	int phase;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	struct json_object *id = json_object_object_get(object, "clientId");
+	if (!id || suspend_votes_client_id)
+		goto out;
+
+	suspend_votes_client_id = g_strdup(json_object_get_string(id));
+	POWERDLOG(LOG_INFO, "Voting for the suspend clients as %s", suspend_votes_client_id);
+
+	for (phase = 0; phase < kSuspendPhaseLast; phase++)
+	{
+		char *uri = g_strconcat(SLEEPD_SUSPEND_SERVICE, suspend_votes[phase].register_method, NULL);
+		char *payload = g_strdup_printf("{\"clientId\":\"%s\",\"register\":true}",
+		                                suspend_votes_client_id);
+
+		LSCallOneReply(GetLunaServiceHandle(), uri, payload, suspend_votes_register_cb,
+		               GINT_TO_POINTER(phase), NULL, NULL);
+
+		g_free(payload);
+		g_free(uri);
+	}
+
+out:
+	json_object_put(object);
+	return true;
+}
+
+/**
+ * @brief Register with sleepd whenever it (re)connects to the bus.
+ */
+static bool
+suspend_votes_sleepd_status(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	int phase;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	bool connected = json_object_get_boolean(json_object_object_get(object, "connected"));
+	json_object_put(object);
+
+	g_free(suspend_votes_client_id);
+	suspend_votes_client_id = NULL;
+	for (phase = 0; phase < kSuspendPhaseLast; phase++)
+	{
+		suspend_votes[phase].registered = false;
+		suspend_votes[phase].open = false;
+		g_hash_table_remove_all(suspend_votes[phase].deadlines);
+		g_hash_table_remove_all(suspend_votes[phase].early);
+	}
+
+	if (!connected)
+		return true;
+
+	/* The identify subscription tells sleepd when powerd goes away. */
+	LSCall(GetLunaServiceHandle(), SLEEPD_SUSPEND_SERVICE"identify",
+	       "{\"subscribe\":true,\"clientName\":\"" SUSPEND_VOTES_CLIENT_NAME "\"}",
+	       suspend_votes_identify_cb, NULL, NULL, NULL);
+	return true;
+}
+
+static int
+SuspendVotesInit(void)
+{
+	int phase;
+	LSError lserror;
+	LSErrorInit(&lserror);
+
+	suspend_votes_wheel = g_timer_wheel_new(GetMainLoopContext(), SUSPEND_VOTES_TICK_MS,
+	                                        SUSPEND_VOTES_WHEEL_SLOTS);
+
+	for (phase = 0; phase < kSuspendPhaseLast; phase++)
+	{
+		suspend_votes[phase].voters = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		suspend_votes[phase].acked = g_hash_table_new(g_str_hash, g_str_equal);
+		suspend_votes[phase].early = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+		suspend_votes[phase].voted = g_hash_table_new(g_str_hash, g_str_equal);
+		suspend_votes[phase].deadlines = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+		                                                       suspend_votes_deadline_free);
+
+		char *match = g_strdup_printf("{\"category\":\"/com/palm/power\",\"method\":\"%s\"}",
+		                              suspend_votes[phase].signal);
+
+		if (!LSCall(GetLunaServiceHandle(), "luna://com.palm.lunabus/signal/addmatch", match,
+		            suspend_votes_signal, GINT_TO_POINTER(phase), NULL, &lserror))
+		{
+			LSErrorPrint(&lserror, stderr);
+			LSErrorFree(&lserror);
+		}
+		g_free(match);
+	}
+
+	if (!LSCall(GetLunaServiceHandle(), "luna://com.palm.lunabus/signal/registerServerStatus",
+	            "{\"serviceName\":\"com.palm.sleep\"}", suspend_votes_sleepd_status,
+	            NULL, NULL, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	return 0;
+}
+
+INIT_FUNC(INIT_FUNC_END, SuspendVotesInit);
@@ -0,0 +1,38 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _SUSPEND_VOTES_H_
+#define _SUSPEND_VOTES_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Phases of a suspend attempt clients vote on.
+ */
+typedef enum {
+	kSuspendPhaseRequest,	/* suspendRequest / suspendRequestAck */
+	kSuspendPhasePrepare,	/* prepareSuspend / prepareSuspendAck */
+	kSuspendPhaseLast,
+} SuspendPhase;
+
+bool suspend_votes_register(const char *client_id, SuspendPhase phase, bool reg);
+bool suspend_votes_ack(const char *client_id, SuspendPhase phase, bool ack);
+void suspend_votes_client_remove(const char *client_id);
+
+#endif // _SUSPEND_VOTES_H_
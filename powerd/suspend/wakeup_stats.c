@@ -0,0 +1,267 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file wakeup_stats.c
+ *
+ * @brief Per wakeup source accounting.
+ *
+ * On a kernel resume every line of the wakeup event list looks like
+ * "[ <timestamp> ] <source> (<detail>) <type> (<count>)". The source name is looked up
+ * and counted; the device then stays awake until the next "suspended" signal, and that awake
+ * time is charged to every source of the wake. Resumes that powerd caused itself are counted
+ * under the resume type ("powerd_activity", "powerd_non_idle").
+ *
+ * The worst offenders are served by luna://com.palm.power/com/palm/power/wakeupStats.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "clock.h"
+#include "init.h"
+#include "logging.h"
+#include "wakeup_stats.h"
+
+#define LOG_DOMAIN "WAKEUP-STATS: "
+
+/* @brief Sources beyond this many are counted as WAKEUP_STATS_OTHER. */
+#define WAKEUP_STATS_MAX_SOURCES	64
+#define WAKEUP_STATS_OTHER		"other"
+
+/* @brief Sources remembered for a single wake. */
+#define WAKEUP_STATS_MAX_WAKE_SOURCES	8
+
+#define WAKEUP_STATS_DEFAULT_COUNT	10
+
+#define WAKEUP_STATS_NAME_LEN		64
+
+typedef struct {
+	char        name[WAKEUP_STATS_NAME_LEN];	/* also the key in wakeup_stats.sources */
+	guint       wakes;
+	time_t      last_wake;		/* RTC seconds */
+	long        awake_ms;		/* cumulative, resume to next suspend */
+} WakeupSource;
+
+static struct {
+	GHashTable     *sources;	/* name -> WakeupSource */
+	guint           wakes;
+
+	/* Current wake, until the next suspend */
+	bool            awake;
+	struct timespec wake_time;
+	time_t          wake_rtc;
+	WakeupSource   *current[WAKEUP_STATS_MAX_WAKE_SOURCES];
+	int             current_count;
+} wakeup_stats;
+
+static WakeupSource *
+wakeup_stats_lookup(const char *name)
+{
+	WakeupSource *source = g_hash_table_lookup(wakeup_stats.sources, name);
+
+	if (source)
+		return source;
+
+	/* Names past the cap are never stored, however many distinct ones the kernel reports */
+	if (g_hash_table_size(wakeup_stats.sources) >= WAKEUP_STATS_MAX_SOURCES)
+	{
+		name = WAKEUP_STATS_OTHER;
+		source = g_hash_table_lookup(wakeup_stats.sources, name);
+		if (source)
+			return source;
+	}
+
+	source = g_new0(WakeupSource, 1);
+	g_strlcpy(source->name, name, sizeof(source->name));
+	g_hash_table_insert(wakeup_stats.sources, source->name, source);
+	return source;
+}
+
+/**
+ * @brief Copy the source name of a wakeup event line into name.
+ *
+ * @retval false if the line has no source name.
+ */
+static bool
+wakeup_stats_parse(const char *line, char *name, size_t len)
+{
+	const char *p = line;
+	size_t n = 0;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	if (*p == '[')
+	{
+		p = strchr(p, ']');
+		if (!p)
+			return false;
+		p++;
+	}
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	while (p[n] && p[n] != ' ' && p[n] != '\t' && p[n] != '(')
+		n++;
+
+	if (n == 0)
+		return false;
+
+	n = MIN(n, len - 1);
+	memcpy(name, p, n);
+	name[n] = '\0';
+	return true;
+}
+
+/**
+ * @brief The device resumed, the sources of the wake follow.
+ */
+void
+wakeup_stats_resume(struct timespec *monotonic, struct timespec *rtc)
+{
+	wakeup_stats.wakes++;
+	wakeup_stats.awake = true;
+	wakeup_stats.wake_time = *monotonic;
+	wakeup_stats.wake_rtc = rtc->tv_sec;
+	wakeup_stats.current_count = 0;
+}
+
+/**
+ * @brief Account a wakeup event line (or a bare source name) to the current wake.
+ */
+void
+wakeup_stats_source(const char *line)
+{
+	char name[WAKEUP_STATS_NAME_LEN];
+	WakeupSource *source;
+	int i;
+
+	if (!wakeup_stats.awake || !line || !wakeup_stats_parse(line, name, sizeof(name)))
+		return;
+
+	source = wakeup_stats_lookup(name);
+
+	/* A source listed twice for the same wake is counted once */
+	for (i = 0; i < wakeup_stats.current_count; i++)
+	{
+		if (wakeup_stats.current[i] == source)
+			return;
+	}
+
+	source->wakes++;
+	source->last_wake = wakeup_stats.wake_rtc;
+
+	if (wakeup_stats.current_count < WAKEUP_STATS_MAX_WAKE_SOURCES)
+		wakeup_stats.current[wakeup_stats.current_count++] = source;
+}
+
+/**
+ * @brief The device is about to suspend, charge the awake time to the sources of the wake.
+ */
+void
+wakeup_stats_suspended(struct timespec *monotonic)
+{
+	struct timespec elapsed;
+	long awake_ms;
+	int i;
+
+	if (!wakeup_stats.awake)
+		return;
+
+	ClockDiff(&elapsed, monotonic, &wakeup_stats.wake_time);
+	awake_ms = ClockGetMs(&elapsed);
+
+	for (i = 0; i < wakeup_stats.current_count; i++)
+		wakeup_stats.current[i]->awake_ms += awake_ms;
+
+	wakeup_stats.awake = false;
+	wakeup_stats.current_count = 0;
+}
+
+static gint
+wakeup_stats_compare(gconstpointer a, gconstpointer b)
+{
+	const WakeupSource *sa = a;
+	const WakeupSource *sb = b;
+
+	if (sa->wakes != sb->wakes)
+		return sa->wakes < sb->wakes ? 1 : -1;
+	if (sa->awake_ms != sb->awake_ms)
+		return sa->awake_ms < sb->awake_ms ? 1 : -1;
+	return strcmp(sa->name, sb->name);
+}
+
+bool
+wakeupStatsQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+	int count = WAKEUP_STATS_DEFAULT_COUNT;
+	GList *sources, *iter;
+	GString *buffer;
+	int i;
+
+	struct json_object *object = json_tokener_parse(LSMessageGetPayload(message));
+	if (!is_error(object))
+	{
+		struct json_object *value = json_object_object_get(object, "count");
+		if (value)
+			count = json_object_get_int(value);
+		json_object_put(object);
+	}
+
+	sources = g_list_sort(g_hash_table_get_values(wakeup_stats.sources), wakeup_stats_compare);
+
+	buffer = g_string_sized_new(512);
+	g_string_append_printf(buffer, "{\"returnValue\":true,\"wakes\":%u,\"sources\":%u,\"top\":[",
+	                       wakeup_stats.wakes, g_hash_table_size(wakeup_stats.sources));
+
+	for (iter = sources, i = 0; iter && i < count; iter = iter->next, i++)
+	{
+		WakeupSource *source = iter->data;
+
+		g_string_append_printf(buffer, "%s{\"source\":\"%s\",\"wakes\":%u,\"last_wake\":%ld,"
+		                       "\"awake_ms\":%ld}",
+		                       i ? "," : "", source->name, source->wakes,
+		                       (long)source->last_wake, source->awake_ms);
+	}
+	g_string_append(buffer, "]}");
+	g_list_free(sources);
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSMessageReply(sh, message, buffer->str, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+	}
+
+	g_string_free(buffer, TRUE);
+	return true;
+}
+
+static int
+WakeupStatsInit(void)
+{
+	wakeup_stats.sources = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+	return 0;
+}
+
+INIT_FUNC(INIT_FUNC_FIRST, WakeupStatsInit);
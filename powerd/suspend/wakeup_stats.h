@@ -0,0 +1,32 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _WAKEUP_STATS_H_
+#define _WAKEUP_STATS_H_
+
+#include <time.h>
+#include <luna-service2/lunaservice.h>
+
+void wakeup_stats_resume(struct timespec *monotonic, struct timespec *rtc);
+void wakeup_stats_source(const char *line);
+void wakeup_stats_suspended(struct timespec *monotonic);
+
+bool wakeupStatsQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _WAKEUP_STATS_H_
@@ -0,0 +1,210 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/**
+ * @file statemachine.c
+ *
+ * @brief Table driven state machines with per transition statistics.
+ *
+ * Every edge taken records a hit count and the cumulative time spent in the state function that
+ * took it. A run is aborted after max_iterations transitions, which catches two states bouncing
+ * between each other. The statistics of all registered machines are served by
+ * luna://com.palm.power/com/palm/power/stateMachineStats.
+ */
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "clock.h"
+#include "logging.h"
+#include "statemachine.h"
+
+#define LOG_DOMAIN "STATEMACHINE: "
+
+/* @brief Default guard, when the owner does not set max_iterations. */
+#define STATE_MACHINE_MAX_ITERATIONS	16
+
+static GSList *state_machines = NULL;
+
+#define EDGE(machine, from, to)	((from) * (machine)->num_states + (to))
+
+static const char *
+StateName(StateMachine *machine, int state)
+{
+    if (state >= 0 && state < machine->num_states && machine->state_names)
+        return machine->state_names[state];
+    return "?";
+}
+
+/**
+ * @brief Build the transition matrix of a machine and make its statistics queryable.
+ */
+void
+StateMachineRegister(StateMachine *machine)
+{
+    int n = machine->num_states;
+    int i;
+
+    machine->allowed = g_new0(bool, n * n);
+    machine->stats = g_new0(StateTransitionStats, n * n);
+
+    for (i = 0; i < n; i++)
+        machine->allowed[EDGE(machine, i, i)] = true;
+
+    for (i = 0; i < machine->num_transitions; i++)
+    {
+        const StateTransition *t = &machine->transitions[i];
+
+        g_assert(t->from >= 0 && t->from < n && t->to >= 0 && t->to < n);
+        machine->allowed[EDGE(machine, t->from, t->to)] = true;
+    }
+
+    if (machine->max_iterations <= 0)
+        machine->max_iterations = STATE_MACHINE_MAX_ITERATIONS;
+
+    state_machines = g_slist_append(state_machines, machine);
+}
+
+static void
+StateMachineRecord(StateMachine *machine, int from, int to, struct timespec *elapsed)
+{
+    StateTransitionStats *stats = &machine->stats[EDGE(machine, from, to)];
+
+    stats->hits++;
+    ClockAccum(&stats->time, elapsed);
+
+    if (!machine->allowed[EDGE(machine, from, to)])
+    {
+        machine->illegal++;
+        POWERDLOG(LOG_ERR, "%s: unexpected transition %s -> %s", machine->name,
+                StateName(machine, from), StateName(machine, to));
+    }
+}
+
+/**
+ * @brief Drive the machine from *state until a state function asks to stay.
+ */
+void
+StateMachineRun(StateMachine *machine, int *state, gpointer data)
+{
+    struct timespec start, end, elapsed;
+    int iterations = 0;
+    int next;
+
+    machine->runs++;
+
+    for (;;)
+    {
+        int current = *state;
+
+        ClockGetTime(&start);
+        next = machine->functions[current](data);
+        ClockGetTime(&end);
+        ClockDiff(&elapsed, &end, &start);
+
+        if (machine->step)
+            machine->step(current, data);
+
+        if (next == machine->num_states)
+        {
+            StateMachineRecord(machine, current, current, &elapsed);
+            break;
+        }
+
+        StateMachineRecord(machine, current, next, &elapsed);
+        *state = next;
+
+        if (++iterations >= machine->max_iterations)
+        {
+            machine->runaway++;
+            POWERDLOG(LOG_CRIT, "%s: %d transitions in one run, stopping in %s",
+                    machine->name, iterations, StateName(machine, next));
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Force the machine into a state from outside of its state functions.
+ */
+void
+StateMachineJump(StateMachine *machine, int *state, int to)
+{
+    struct timespec none;
+
+    ClockClear(&none);
+    StateMachineRecord(machine, *state, to, &none);
+    *state = to;
+}
+
+static void
+StateMachineStatsAppend(GString *buffer, StateMachine *machine)
+{
+    bool first = true;
+    int from, to;
+
+    g_string_append_printf(buffer, "{\"name\":\"%s\",\"runs\":%u,\"illegal\":%u,\"runaway\":%u,"
+            "\"transitions\":[", machine->name, machine->runs, machine->illegal, machine->runaway);
+
+    for (from = 0; from < machine->num_states; from++)
+    {
+        for (to = 0; to < machine->num_states; to++)
+        {
+            StateTransitionStats *stats = &machine->stats[EDGE(machine, from, to)];
+
+            if (!stats->hits)
+                continue;
+
+            g_string_append_printf(buffer, "%s{\"from\":\"%s\",\"to\":\"%s\",\"hits\":%u,"
+                    "\"time_us\":%lld}",
+                    first ? "" : ",",
+                    StateName(machine, from), StateName(machine, to), stats->hits,
+                    (long long)stats->time.tv_sec * 1000000 + stats->time.tv_nsec / 1000);
+            first = false;
+        }
+    }
+
+    g_string_append(buffer, "]}");
+}
+
+bool
+stateMachineStatsQuery(LSHandle *sh, LSMessage *message, void *user_data)
+{
+    GString *buffer = g_string_sized_new(512);
+    GSList *iter;
+
+    g_string_append(buffer, "{\"returnValue\":true,\"machines\":[");
+    for (iter = state_machines; iter; iter = iter->next)
+    {
+        StateMachineStatsAppend(buffer, iter->data);
+        if (iter->next)
+            g_string_append_c(buffer, ',');
+    }
+    g_string_append(buffer, "]}");
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+    if (!LSMessageReply(sh, message, buffer->str, &lserror))
+    {
+        LSErrorPrint(&lserror, stderr);
+        LSErrorFree(&lserror);
+    }
+
+    g_string_free(buffer, TRUE);
+    return true;
+}
@@ -0,0 +1,82 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+#ifndef _STATEMACHINE_H_
+#define _STATEMACHINE_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/**
+ * @brief A state function runs the given state and returns the next one, or the machine's
+ * num_states to stay in the current state until the next run.
+ */
+typedef int (*StateFunc)(gpointer data);
+
+/**
+ * @brief Called after each state function with the state that just ran.
+ */
+typedef void (*StateStepFunc)(int state, gpointer data);
+
+/**
+ * @brief One allowed edge of a state machine.
+ */
+typedef struct {
+    int from;
+    int to;
+} StateTransition;
+
+typedef struct {
+    guint           hits;
+    struct timespec time;    /* cumulative time spent in the state function taking the edge */
+} StateTransitionStats;
+
+/**
+ * @brief A declarative state machine.
+ *
+ * The owner fills in the descriptive part statically and calls StateMachineRegister() once.
+ * Transitions which are not listed in the table are still taken, but logged and counted.
+ */
+typedef struct {
+    const char             *name;
+    const char * const     *state_names;
+    const StateFunc        *functions;     /* indexed by state */
+    int                     num_states;
+    const StateTransition  *transitions;
+    int                     num_transitions;
+    int                     max_iterations;
+    StateStepFunc           step;
+
+    /* private */
+    bool                   *allowed;       /* num_states x num_states */
+    StateTransitionStats   *stats;         /* num_states x num_states, staying counts as from -> from */
+    guint                   runs;
+    guint                   illegal;
+    guint                   runaway;
+} StateMachine;
+
+void StateMachineRegister(StateMachine *machine);
+
+void StateMachineRun(StateMachine *machine, int *state, gpointer data);
+
+void StateMachineJump(StateMachine *machine, int *state, int to);
+
+bool stateMachineStatsQuery(LSHandle *sh, LSMessage *message, void *user_data);
+
+#endif // _STATEMACHINE_H_
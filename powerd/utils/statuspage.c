@@ -0,0 +1,158 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file statuspage.c
+ *
+ * @brief Publish the battery and charger state in a memory mapped file, so that libpowerd clients
+ * can read it with PowerdBatteryStatusGet() / PowerdChargerStatusGet() without a bus round trip.
+ *
+ * The file is reused across powerd restarts, so clients that already mapped it keep seeing updates.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "init.h"
+#include "logging.h"
+#include "powerdstatus.h"
+#include "statuspage.h"
+
+#define LOG_DOMAIN "STATUSPAGE: "
+
+static PowerdStatusPage *status_page = NULL;
+
+void
+StatusPagePublishBattery(const PowerdBatteryStatus *battery)
+{
+    if (!status_page)
+        return;
+
+    PowerdStatusPageWriteBegin(status_page);
+    status_page->battery = *battery;
+    status_page->battery_valid = 1;
+    PowerdStatusPageWriteEnd(status_page);
+}
+
+void
+StatusPagePublishCharger(const PowerdChargerStatus *charger)
+{
+    if (!status_page)
+        return;
+
+    PowerdStatusPageWriteBegin(status_page);
+    status_page->charger = *charger;
+    status_page->charger_valid = 1;
+    PowerdStatusPageWriteEnd(status_page);
+}
+
+/**
+ * @brief Open the status page, creating it if needed.
+ *
+ * A page left by a previous instance is reused as is. A new page is built and sized in a temporary
+ * file and renamed into place, so that clients never find a short file at POWERD_STATUS_PAGE_PATH.
+ */
+static int
+StatusPageOpen(void)
+{
+    struct stat st;
+    int fd = open(POWERD_STATUS_PAGE_PATH, O_RDWR);
+
+    if (fd >= 0)
+    {
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(PowerdStatusPage))
+            return fd;
+        close(fd);
+    }
+
+    char tmp[] = POWERD_STATUS_PAGE_PATH ".XXXXXX";
+    fd = mkstemp(tmp);
+    if (fd < 0)
+    {
+        POWERDLOG(LOG_WARNING, "Could not create %s", tmp);
+        return -1;
+    }
+
+    if (fchmod(fd, 0644) < 0 || ftruncate(fd, sizeof(PowerdStatusPage)) < 0)
+    {
+        POWERDLOG(LOG_WARNING, "Could not size %s", tmp);
+        goto error;
+    }
+
+    if (rename(tmp, POWERD_STATUS_PAGE_PATH) < 0)
+    {
+        POWERDLOG(LOG_WARNING, "Could not rename %s to %s", tmp, POWERD_STATUS_PAGE_PATH);
+        goto error;
+    }
+
+    return fd;
+
+error:
+    unlink(tmp);
+    close(fd);
+    return -1;
+}
+
+static int
+StatusPageInit(void)
+{
+    int fd = StatusPageOpen();
+    if (fd < 0)
+        return 0;
+
+    void *addr = mmap(NULL, sizeof(PowerdStatusPage), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        POWERDLOG(LOG_WARNING, "Could not map %s", POWERD_STATUS_PAGE_PATH);
+        goto out;
+    }
+
+    status_page = addr;
+
+    /* A previous instance may have died in the middle of an update. */
+    if (status_page->sequence & 1)
+        status_page->sequence++;
+
+    if (status_page->magic != POWERD_STATUS_PAGE_MAGIC ||
+        status_page->version != POWERD_STATUS_PAGE_VERSION)
+    {
+        PowerdStatusPageWriteBegin(status_page);
+        status_page->version = POWERD_STATUS_PAGE_VERSION;
+        status_page->battery_valid = 0;
+        status_page->charger_valid = 0;
+        memset(&status_page->battery, 0, sizeof(status_page->battery));
+        memset(&status_page->charger, 0, sizeof(status_page->charger));
+        status_page->magic = POWERD_STATUS_PAGE_MAGIC;
+        PowerdStatusPageWriteEnd(status_page);
+    }
+
+out:
+    close(fd);
+    return 0;
+}
+
+INIT_FUNC(INIT_FUNC_FIRST, StatusPageInit);
@@ -0,0 +1,293 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file subscription.c
+ *
+ * @brief Luna subscriptions with server side filtering.
+ *
+ * The owner of a subscription list describes its state as an array of integer fields. A subscriber
+ * may restrict itself to some of the fields and give a per-field threshold:
+ *
+ * {"subscribe":true, "fields":["percent"], "thresholds":{"percent":5}}
+ *
+ * and is only sent a reply once one of its fields moved by at least its threshold (default 1, i.e.
+ * any change) since the last reply it got. Subscribers that do not list any fields get every change.
+ *
+ * Fields that stand for a string (a serial number, a name) are declared change-only: the owner
+ * gives them a value that only tells whether the string changed, so they have no threshold and a
+ * subscription request that sets one is rejected.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <cjson/json.h>
+
+#include "logging.h"
+#include "lunaservice_utils.h"
+#include "subscription.h"
+
+#define LOG_DOMAIN "SUBSCRIPTION: "
+
+/* @brief Fields are bits of a guint32 mask. */
+#define SUBSCRIPTION_MAX_FIELDS	31
+
+typedef struct {
+	LSMessage *message;
+	guint32    fields;
+	int        thresholds[SUBSCRIPTION_MAX_FIELDS];
+	int        last[SUBSCRIPTION_MAX_FIELDS];
+} Subscriber;
+
+struct _SubscriptionList {
+	const char  *key;
+	const char **fields;
+	int          n_fields;
+	guint32      change_only;	/* fields without a magnitude, see SubscriptionListNew() */
+	GHashTable  *subscribers;	/* unique token -> Subscriber */
+};
+
+static GSList *subscription_lists = NULL;
+
+static void
+SubscriberFree(gpointer data)
+{
+	Subscriber *subscriber = data;
+
+	LSMessageUnref(subscriber->message);
+	g_free(subscriber);
+}
+
+static int
+SubscriptionFieldIndex(SubscriptionList *list, const char *name)
+{
+	int i;
+
+	for (i = 0; name && i < list->n_fields; i++)
+	{
+		if (strcmp(list->fields[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * @brief Create a subscription list for the given luna subscription key and state fields.
+ *
+ * @param change_only Mask of the fields (1u << index) that can only be compared for equality,
+ * e.g. a count of the changes of a string.
+ */
+SubscriptionList *
+SubscriptionListNew(const char *key, const char **fields, int n_fields, unsigned int change_only)
+{
+	if (n_fields > SUBSCRIPTION_MAX_FIELDS)
+	{
+		POWERDLOG(LOG_ERR, "%s: %s has %d fields, at most %d are supported", __FUNCTION__, key,
+		          n_fields, SUBSCRIPTION_MAX_FIELDS);
+		return NULL;
+	}
+
+	SubscriptionList *list = g_new0(SubscriptionList, 1);
+
+	list->key = key;
+	list->fields = fields;
+	list->n_fields = n_fields;
+	list->change_only = change_only;
+	list->subscribers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, SubscriberFree);
+
+	subscription_lists = g_slist_prepend(subscription_lists, list);
+	return list;
+}
+
+/**
+ * @brief Add the sender of message to the list if it asked to subscribe.
+ *
+ * @param values Current state, the subscriber is considered up to date with it.
+ *
+ * @retval false if the request was invalid, it has then been answered with an error.
+ */
+bool
+SubscriptionListAdd(SubscriptionList *list, LSHandle *sh, LSMessage *message, const int *values)
+{
+	struct json_object *object;
+	bool valid = true;
+	int i;
+
+	if (!list)
+		return true;
+
+	object = json_tokener_parse(LSMessageGetPayload(message));
+	if (is_error(object))
+		return true;
+
+	if (!json_object_get_boolean(json_object_object_get(object, "subscribe")))
+		goto end;
+
+	Subscriber *subscriber = g_new0(Subscriber, 1);
+
+	struct json_object *fields = json_object_object_get(object, "fields");
+	if (fields && json_object_is_type(fields, json_type_array))
+	{
+		for (i = 0; i < json_object_array_length(fields); i++)
+		{
+			int index = SubscriptionFieldIndex(list,
+			        json_object_get_string(json_object_array_get_idx(fields, i)));
+			if (index >= 0)
+				subscriber->fields |= (1u << index);
+		}
+	}
+	if (!subscriber->fields)
+		subscriber->fields = ~0u;
+
+	struct json_object *thresholds = json_object_object_get(object, "thresholds");
+	for (i = 0; i < list->n_fields; i++)
+	{
+		struct json_object *threshold =
+		    thresholds ? json_object_object_get(thresholds, list->fields[i]) : NULL;
+
+		if (threshold && (list->change_only & (1u << i)))
+		{
+			POWERDLOG(LOG_WARNING, "%s: %s set a threshold on %s of %s, which can only change",
+			          __FUNCTION__, LSMessageGetSender(message), list->fields[i], list->key);
+			LSMessageReplyErrorInvalidParams(sh, message);
+			g_free(subscriber);
+			valid = false;
+			goto end;
+		}
+
+		subscriber->thresholds[i] = threshold ? MAX(json_object_get_int(threshold), 1) : 1;
+		subscriber->last[i] = values[i];
+	}
+
+	LSError lserror;
+	LSErrorInit(&lserror);
+	if (!LSSubscriptionAdd(sh, list->key, message, &lserror))
+	{
+		LSErrorPrint(&lserror, stderr);
+		LSErrorFree(&lserror);
+		g_free(subscriber);
+		goto end;
+	}
+
+	LSMessageRef(message);
+	subscriber->message = message;
+	g_hash_table_replace(list->subscribers,
+	                     g_strdup(LSMessageGetUniqueToken(message)), subscriber);
+
+	POWERDLOG(LOG_DEBUG, "%s: %s subscribed to %s (%u subscribers)", __FUNCTION__,
+	          LSMessageGetSender(message), list->key,
+	          g_hash_table_size(list->subscribers));
+
+end:
+	json_object_put(object);
+	return valid;
+}
+
+static bool
+SubscriberIsAffected(SubscriptionList *list, Subscriber *subscriber, const int *values)
+{
+	int i;
+
+	for (i = 0; i < list->n_fields; i++)
+	{
+		if (!(subscriber->fields & (1u << i)) || values[i] == subscriber->last[i])
+			continue;
+
+		if (list->change_only & (1u << i))
+			return true;
+
+		long long delta = (long long)values[i] - subscriber->last[i];
+		if (llabs(delta) >= subscriber->thresholds[i])
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Send payload to the subscribers affected by the new state in values.
+ */
+void
+SubscriptionListNotify(SubscriptionList *list, const int *values, const char *payload)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	guint sent = 0;
+
+	if (!list)
+		return;
+
+	g_hash_table_iter_init(&iter, list->subscribers);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		Subscriber *subscriber = value;
+
+		if (!SubscriberIsAffected(list, subscriber, values))
+			continue;
+
+		LSError lserror;
+		LSErrorInit(&lserror);
+		if (!LSMessageReply(LSMessageGetConnection(subscriber->message),
+		                    subscriber->message, payload, &lserror))
+		{
+			LSErrorPrint(&lserror, stderr);
+			LSErrorFree(&lserror);
+		}
+
+		memcpy(subscriber->last, values, list->n_fields * sizeof(int));
+		sent++;
+	}
+
+	if (sent)
+		POWERDLOG(LOG_DEBUG, "%s: %s sent to %u of %u subscribers", __FUNCTION__,
+		          list->key, sent, g_hash_table_size(list->subscribers));
+}
+
+unsigned int
+SubscriptionListCount(SubscriptionList *list)
+{
+	return list ? g_hash_table_size(list->subscribers) : 0;
+}
+
+/**
+ * @brief Drop a cancelled subscription.
+ *
+ * @retval true if message belonged to one of the subscription lists.
+ */
+bool
+SubscriptionCancel(LSMessage *message)
+{
+	const char *token = LSMessageGetUniqueToken(message);
+	GSList *iter;
+
+	if (!token)
+		return false;
+
+	for (iter = subscription_lists; iter; iter = iter->next)
+	{
+		SubscriptionList *list = iter->data;
+
+		if (g_hash_table_remove(list->subscribers, token))
+		{
+			POWERDLOG(LOG_DEBUG, "%s: subscription to %s cancelled", __FUNCTION__, list->key);
+			return true;
+		}
+	}
+	return false;
+}
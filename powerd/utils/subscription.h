@@ -0,0 +1,39 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _SUBSCRIPTION_H_
+#define _SUBSCRIPTION_H_
+
+#include <stdbool.h>
+#include <luna-service2/lunaservice.h>
+
+typedef struct _SubscriptionList SubscriptionList;
+
+SubscriptionList *SubscriptionListNew(const char *key, const char **fields, int n_fields,
+                                      unsigned int change_only);
+
+bool SubscriptionListAdd(SubscriptionList *list, LSHandle *sh, LSMessage *message, const int *values);
+
+void SubscriptionListNotify(SubscriptionList *list, const int *values, const char *payload);
+
+unsigned int SubscriptionListCount(SubscriptionList *list);
+
+bool SubscriptionCancel(LSMessage *message);
+
+#endif // _SUBSCRIPTION_H_
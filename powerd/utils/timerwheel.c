@@ -0,0 +1,283 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+/**
+ * @file timerwheel.c
+ *
+ * @brief GTimerWheel - a hashed timer wheel for large numbers of cheap, coarse timers.
+ *
+ * Timers are hashed into one of a fixed number of slots by their expiration tick and kept in a
+ * doubly linked list per slot, so that adding and cancelling a timer is O(1) regardless of how
+ * many are pending. Timers further away than one revolution of the wheel carry the number of
+ * revolutions left.
+ *
+ * A single GTimerSource ticks the wheel, and only while timers are pending. Like GTimerSource
+ * the wheel runs on the monotonic clock, so timers do not expire while the device is suspended.
+ *
+ * A timer handle is only valid until its callback runs or it is cancelled.
+ */
+
+#include <glib.h>
+
+#include "timerwheel.h"
+#include "timersource.h"
+#include "clock.h"
+
+typedef struct _GTimerWheelList
+{
+    GTimerWheelTimer *head;
+} GTimerWheelList;
+
+struct _GTimerWheelTimer
+{
+    GTimerWheelTimer *next;
+    GTimerWheelTimer *prev;
+    GTimerWheelList  *list;        /* slot (or expired list) the timer is on */
+    guint             rounds;      /* revolutions left before expiring */
+    GTimerWheelFunc   func;
+    gpointer          user_data;
+};
+
+struct _GTimerWheel
+{
+    GMainContext    *context;
+    GTimerSource    *source;
+    guint            tick_ms;
+    guint            nslots;
+    guint            current;       /* slot of the last tick */
+    guint            pending;
+    struct timespec  last_tick;
+
+    GTimerWheelList *slots;
+    GTimerWheelList  expired;       /* being dispatched */
+};
+
+static void
+g_timer_wheel_link(GTimerWheelList *list, GTimerWheelTimer *timer)
+{
+    timer->list = list;
+    timer->prev = NULL;
+    timer->next = list->head;
+    if (list->head)
+        list->head->prev = timer;
+    list->head = timer;
+}
+
+static void
+g_timer_wheel_unlink(GTimerWheelTimer *timer)
+{
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        timer->list->head = timer->next;
+
+    if (timer->next)
+        timer->next->prev = timer->prev;
+
+    timer->list = NULL;
+    timer->next = timer->prev = NULL;
+}
+
+/**
+ * @brief Move the timers of a slot that expire on this revolution to the expired list.
+ */
+static void
+g_timer_wheel_advance(GTimerWheel *wheel)
+{
+    GTimerWheelTimer *timer, *next;
+
+    wheel->current = (wheel->current + 1) % wheel->nslots;
+
+    for (timer = wheel->slots[wheel->current].head; timer; timer = next)
+    {
+        next = timer->next;
+
+        if (timer->rounds)
+        {
+            timer->rounds--;
+            continue;
+        }
+
+        g_timer_wheel_unlink(timer);
+        g_timer_wheel_link(&wheel->expired, timer);
+    }
+}
+
+static void
+g_timer_wheel_stop(GTimerWheel *wheel)
+{
+    if (wheel->source)
+    {
+        g_source_destroy((GSource*)wheel->source);
+        g_source_unref((GSource*)wheel->source);
+        wheel->source = NULL;
+    }
+}
+
+static gboolean
+g_timer_wheel_tick(gpointer data)
+{
+    GTimerWheel *wheel = data;
+    struct timespec now, elapsed;
+    long ticks;
+
+    /* Catch up on the ticks missed while the main loop was busy */
+    ClockGetTime(&now);
+    ClockDiff(&elapsed, &now, &wheel->last_tick);
+    ticks = MAX(ClockGetMs(&elapsed) / (long)wheel->tick_ms, 1);
+
+    while (ticks-- > 0)
+    {
+        g_timer_wheel_advance(wheel);
+        ClockAccumMs(&wheel->last_tick, wheel->tick_ms);
+    }
+
+    while (wheel->expired.head)
+    {
+        GTimerWheelTimer *timer = wheel->expired.head;
+        GTimerWheelFunc func = timer->func;
+        gpointer user_data = timer->user_data;
+
+        g_timer_wheel_unlink(timer);
+        g_free(timer);
+        wheel->pending--;
+
+        /* The callback may add or cancel timers, including the expired ones. */
+        func(user_data);
+    }
+
+    /* A callback that cancelled the last timer already stopped the source. */
+    if (wheel->pending == 0 && wheel->source)
+    {
+        g_source_unref((GSource*)wheel->source);
+        wheel->source = NULL;
+        return FALSE;
+    }
+
+    return wheel->pending > 0;
+}
+
+static void
+g_timer_wheel_start(GTimerWheel *wheel)
+{
+    if (wheel->source)
+        return;
+
+    ClockGetTime(&wheel->last_tick);
+
+    wheel->source = g_timer_source_new(wheel->tick_ms, 0);
+    g_source_set_callback((GSource*)wheel->source, g_timer_wheel_tick, wheel, NULL);
+    g_source_attach((GSource*)wheel->source, wheel->context);
+}
+
+/** Public Functions */
+
+/**
+* @brief Create a timer wheel with the given tick resolution and number of slots.
+*
+* Timers up to tick_ms * slots away are placed without a revolution count; further ones still
+* work, they just get visited once per revolution.
+*/
+GTimerWheel *
+g_timer_wheel_new(GMainContext *context, guint tick_ms, guint slots)
+{
+    GTimerWheel *wheel = g_new0(GTimerWheel, 1);
+
+    wheel->context = context;
+    wheel->tick_ms = MAX(tick_ms, 1);
+    wheel->nslots = MAX(slots, 1);
+    wheel->slots = g_new0(GTimerWheelList, wheel->nslots);
+
+    return wheel;
+}
+
+void
+g_timer_wheel_free(GTimerWheel *wheel)
+{
+    guint i;
+
+    g_timer_wheel_stop(wheel);
+
+    for (i = 0; i < wheel->nslots; i++)
+    {
+        while (wheel->slots[i].head)
+        {
+            GTimerWheelTimer *timer = wheel->slots[i].head;
+            g_timer_wheel_unlink(timer);
+            g_free(timer);
+        }
+    }
+
+    while (wheel->expired.head)
+    {
+        GTimerWheelTimer *timer = wheel->expired.head;
+        g_timer_wheel_unlink(timer);
+        g_free(timer);
+    }
+
+    g_free(wheel->slots);
+    g_free(wheel);
+}
+
+/**
+* @brief Call func(user_data) once, timeout_ms from now (rounded up to the tick).
+*
+* @retval Handle to cancel the timer with, valid until the callback runs.
+*/
+GTimerWheelTimer *
+g_timer_wheel_add(GTimerWheel *wheel, guint timeout_ms,
+                  GTimerWheelFunc func, gpointer user_data)
+{
+    GTimerWheelTimer *timer = g_new0(GTimerWheelTimer, 1);
+    guint ticks = MAX((timeout_ms + wheel->tick_ms - 1) / wheel->tick_ms, 1);
+
+    timer->func = func;
+    timer->user_data = user_data;
+    timer->rounds = (ticks - 1) / wheel->nslots;
+
+    g_timer_wheel_start(wheel);
+
+    g_timer_wheel_link(&wheel->slots[(wheel->current + ticks) % wheel->nslots], timer);
+    wheel->pending++;
+
+    return timer;
+}
+
+/**
+* @brief Cancel a pending timer.
+*/
+void
+g_timer_wheel_cancel(GTimerWheel *wheel, GTimerWheelTimer *timer)
+{
+    if (!timer)
+        return;
+
+    g_timer_wheel_unlink(timer);
+    g_free(timer);
+    wheel->pending--;
+
+    if (wheel->pending == 0)
+        g_timer_wheel_stop(wheel);
+}
+
+guint
+g_timer_wheel_pending(GTimerWheel *wheel)
+{
+    return wheel->pending;
+}
@@ -0,0 +1,41 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2007-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <glib.h>
+
+typedef struct _GTimerWheel GTimerWheel;
+typedef struct _GTimerWheelTimer GTimerWheelTimer;
+
+typedef void (*GTimerWheelFunc)(gpointer user_data);
+
+GTimerWheel *g_timer_wheel_new(GMainContext *context, guint tick_ms, guint slots);
+
+void g_timer_wheel_free(GTimerWheel *wheel);
+
+GTimerWheelTimer *g_timer_wheel_add(GTimerWheel *wheel, guint timeout_ms,
+                                    GTimerWheelFunc func, gpointer user_data);
+
+void g_timer_wheel_cancel(GTimerWheel *wheel, GTimerWheelTimer *timer);
+
+guint g_timer_wheel_pending(GTimerWheel *wheel);
+
+#endif